@@ -371,7 +371,8 @@ public:
     ~ResourceManager()
     {
         for (auto& i : Data)
-            i->~Texture();
+            delete i;
+        Data.clear();
     }
 
     Texture& GetTex(int ResID) const
@@ -3,20 +3,47 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <cmath>
 #include <fstream>
 #include <sstream>
-
+#include <unordered_map>
+#include <list>
+#include <utility>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <climits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
 #pragma comment(lib, "SDL3.lib")
 #pragma comment(lib, "SDL3_ttf.lib")
+#endif
 
 // --- Forward Declarations & Global Constants ---
 class RenderInterface;
 class GameState;
 class Window;
 class CastleInfoWnd;
-class Castle;
 
 const float HEX_SIDE_LENGTH = 24.0f;
 const float HEX_FLAT_TOP_WIDTH = HEX_SIDE_LENGTH * 2.0f;
@@ -24,6 +51,7 @@ const float HEX_FLAT_TOP_HEIGHT = HEX_FLAT_TOP_WIDTH;
 const float HORIZONTAL_SPACING = HEX_FLAT_TOP_WIDTH;
 const float VERTICAL_SPACING = HEX_FLAT_TOP_HEIGHT;
 const float ODD_ROW_X_OFFSET = HEX_FLAT_TOP_WIDTH * 0.5f;
+const float SQRT_3 = 1.7320508f;
 // --- End Forward Declarations ---
 
 struct DebugManager
@@ -32,6 +60,16 @@ struct DebugManager
 };
 DebugManager DM;
 
+// Set by anything that changes what is on screen (input, simulation, camera motion, streamed
+// tiles, uploaded textures); the loop only redraws while it is set in on-demand mode.
+struct RedrawTracker
+{
+    bool bDirty = true;
+
+    void Invalidate() { bDirty = true; }
+};
+RedrawTracker Redraw;
+
 class Viewport
 {
 public:
@@ -39,6 +77,52 @@ public:
     const int HEIGHT = 960;
 };
 
+// Scrollable view onto the map: X/Y is the world position of the screen's top-left corner.
+struct Camera
+{
+    float X = 0;
+    float Y = 0;
+    float ViewW = 0;
+    float ViewH = 0;
+    float WorldW = 0;
+    float WorldH = 0;
+
+    void SetBounds(float a_ViewW, float a_ViewH, float a_WorldW, float a_WorldH)
+    {
+        ViewW = a_ViewW;
+        ViewH = a_ViewH;
+        WorldW = a_WorldW;
+        WorldH = a_WorldH;
+        Pan(0, 0);
+    }
+
+    void Pan(float dx, float dy)
+    {
+        X = std::clamp(X + dx, 0.0f, std::max(0.0f, WorldW - ViewW));
+        Y = std::clamp(Y + dy, 0.0f, std::max(0.0f, WorldH - ViewH));
+    }
+
+    SDL_FRect WorldToScreen(const SDL_FRect& WorldRect) const
+    {
+        return { WorldRect.x - X, WorldRect.y - Y, WorldRect.w, WorldRect.h };
+    }
+
+    void ScreenToWorld(float sx, float sy, float& wx, float& wy) const
+    {
+        wx = sx + X;
+        wy = sy + Y;
+    }
+
+    // Position Alpha of the way from From to To (0..1); bounds are taken from To.
+    static Camera Lerp(const Camera& From, const Camera& To, float Alpha)
+    {
+        Camera c = To;
+        c.X = From.X + (To.X - From.X) * Alpha;
+        c.Y = From.Y + (To.Y - From.Y) * Alpha;
+        return c;
+    }
+};
+
 struct Location
 {
     float x = 0;
@@ -57,31 +141,52 @@ struct Rect
     int h = 0;
 };
 
+// View of one bitmap inside a shared atlas page. W/H is the size used for layout; Region is
+// where the bitmap sits in the page. While the bitmap is not resident, Tex is a shared 1x1
+// placeholder. Version changes whenever the view moves, so cached UVs can be refreshed.
 class Texture
 {
 public:
     SDL_Texture* Tex = nullptr;
     float W = 0;
     float H = 0;
-    Texture(SDL_Renderer* renderer, const std::string& Name, float Width, float Height)
-    {
-        SDL_Surface* bmp = SDL_LoadBMP(Name.c_str());
-        if (!bmp)
-            std::cerr << "Failed to load BMP: " << Name << " - " << SDL_GetError() << std::endl;
+    SDL_FRect Region = { 0, 0, 1, 1 };
+    float PageW = 1;
+    float PageH = 1;
+    bool bReady = false;
+    Uint32 Version = 0;
 
-        Tex = SDL_CreateTextureFromSurface(renderer, bmp);
-        if (!Tex)
-            std::cerr << "Failed to create texture from surface: " << Name << " - " << SDL_GetError() << std::endl;
+    Texture(SDL_Texture* Placeholder, float Width, float Height) : Tex(Placeholder), W(Width), H(Height) {}
 
-        SDL_DestroySurface(bmp);
+    void SetRegion(SDL_Texture* Page, const SDL_FRect& a_Region, float a_PageW, float a_PageH)
+    {
+        Tex = Page;
+        Region = a_Region;
+        PageW = a_PageW;
+        PageH = a_PageH;
+        bReady = true;
+        ++Version;
+    }
 
-        W = Width;
-        H = Height;
+    void Reset(SDL_Texture* Placeholder)
+    {
+        Tex = Placeholder;
+        Region = { 0, 0, 1, 1 };
+        PageW = PageH = 1;
+        bReady = false;
+        ++Version;
     }
-    ~Texture()
+
+    // Maps a rect in bitmap pixels into the page, clipped to the bitmap so neighbours never show.
+    SDL_FRect PageRect(const SDL_FRect& Src) const
     {
-        if (Tex)
-            SDL_DestroyTexture(Tex);
+        if (!bReady)
+            return Region;
+        float x0 = std::clamp(Src.x, 0.0f, Region.w);
+        float y0 = std::clamp(Src.y, 0.0f, Region.h);
+        float x1 = std::clamp(Src.x + Src.w, 0.0f, Region.w);
+        float y1 = std::clamp(Src.y + Src.h, 0.0f, Region.h);
+        return { Region.x + x0, Region.y + y0, x1 - x0, y1 - y0 };
     }
 };
 
@@ -93,77 +198,80 @@ enum Faction
     Faction_Oh = 3,
 };
 
-class Object
+// Generational entity handle; goes stale once EntityWorld destroys the entity it refers to.
+struct EntityHandle
 {
-protected:
+    static const Uint32 InvalidIndex = 0xFFFFFFFF;
+    Uint32 Index = InvalidIndex;
+    Uint32 Generation = 0;
 
-    SDL_FRect SrcRect = { 0,0,0,0 };
-    Faction Fac = Faction_None;
-public:
-    std::string Name;
-    int dx = 0;
-    int dy = 0;
-    bool show = true;
-    Location Loc; // Not directly used for rendering objects on map tiles in this setup
+    bool operator==(const EntityHandle& Other) const { return Index == Other.Index && Generation == Other.Generation; }
+    bool operator!=(const EntityHandle& Other) const { return !(*this == Other); }
+};
 
-    Texture* pTex = nullptr;
+using Entity = EntityHandle;
 
-    virtual ~Object() {}
+// Unit kinds only differ in data; the value is the sprite column in Army.bmp.
+enum UnitType
+{
+    Unit_Swordman = 0,
+    Unit_Spearman = 1,
+    Unit_Polearm = 2,
+    Unit_Castle = 7,
+};
 
+struct CellComponent
+{
     int MapIndex = 0;
+};
 
-    virtual void Update() {}
-    void Init(Texture& Tex, int InitialMapIndex)
-    {
-        pTex = &Tex;
-        MapIndex = InitialMapIndex;
-    }
-
-    SDL_FRect GetSrcRect() const { return SrcRect; }
+// Counted reference to a ResourceManager texture. A texture with handles to it is never evicted.
+class TextureHandle
+{
+    int ResID = -1;
 
-    void MoveDelta(const Location& Delta)
+public:
+    TextureHandle() = default;
+    explicit TextureHandle(int a_ResID);
+    TextureHandle(const TextureHandle& Other);
+    TextureHandle(TextureHandle&& Other) noexcept : ResID(Other.ResID) { Other.ResID = -1; }
+    TextureHandle& operator=(TextureHandle Other) noexcept
     {
-        Loc += Delta;
+        std::swap(ResID, Other.ResID);
+        return *this;
     }
+    ~TextureHandle();
+
+    // Marks the texture used this frame and starts loading it on first use.
+    Texture* Get() const;
+    int GetID() const { return ResID; }
+    explicit operator bool() const { return ResID >= 0; }
 };
 
-class Swordman : public Object
+struct SpriteComponent
 {
-public:
-    Swordman(Faction a_Fac)
-    {
-        Fac = a_Fac;
-        SrcRect = { 0,192 + 32 * static_cast<float>(Fac), 32 ,32 };
-    }
+    TextureHandle Tex;
+    SDL_FRect SrcRect = { 0,0,0,0 };
+    bool bShow = true; // Cleared to have the entity destroyed at the end of the update
 };
 
-class Spearman : public Object
+struct FactionComponent
 {
-public:
-    Spearman(Faction a_Fac)
-    {
-        Fac = a_Fac;
-        SrcRect = { 32,192 + 32 * static_cast<float>(Fac), 32,32 };
-    }
+    Faction Fac = Faction_None;
 };
-class Polearm : public Object
+
+struct CastleComponent
 {
-public:
-    Polearm(Faction a_Fac)
-    {
-        Fac = a_Fac;
-        SrcRect = { 64,192 + 32 * static_cast<float>(Fac), 32,32 };
-    }
+    std::string Name;
 };
 
-class Castle : public Object
+// A castle's numbers as handed to and read back from CastleEconomy, which stores them.
+struct CastleStats
 {
-public:
     int Gold = 0;
     int Food = 0;
-private:
-    int Order = 90;
 
+    int Order = 90;
     int Duration = 2700;
 
     int Soldier = 14000;
@@ -178,19 +286,310 @@ private:
     int FoodPerSeason = 8000;
 
     int NumOfPerson = 0;
+};
+
+// Sparse set: components are packed contiguously for iteration, Sparse maps entity index to slot.
+template<typename T>
+class ComponentArray
+{
+    static constexpr Uint32 Absent = 0xFFFFFFFF;
+    std::vector<T> Dense;
+    std::vector<Uint32> DenseEntity;
+    std::vector<Uint32> Sparse;
+
+public:
+    T& Add(Uint32 EntityIndex, T Value = T())
+    {
+        if (EntityIndex >= Sparse.size())
+            Sparse.resize(EntityIndex + 1, Absent);
+        if (Sparse[EntityIndex] != Absent)
+            return Dense[Sparse[EntityIndex]] = std::move(Value);
+
+        Sparse[EntityIndex] = static_cast<Uint32>(Dense.size());
+        Dense.push_back(std::move(Value));
+        DenseEntity.push_back(EntityIndex);
+        return Dense.back();
+    }
+
+    void Remove(Uint32 EntityIndex)
+    {
+        if (!Has(EntityIndex))
+            return;
+        Uint32 slot = Sparse[EntityIndex];
+        Uint32 last = static_cast<Uint32>(Dense.size() - 1);
+        if (slot != last)
+        {
+            Dense[slot] = std::move(Dense[last]);
+            DenseEntity[slot] = DenseEntity[last];
+            Sparse[DenseEntity[slot]] = slot;
+        }
+        Dense.pop_back();
+        DenseEntity.pop_back();
+        Sparse[EntityIndex] = Absent;
+    }
+
+    bool Has(Uint32 EntityIndex) const { return EntityIndex < Sparse.size() && Sparse[EntityIndex] != Absent; }
+    T* Get(Uint32 EntityIndex) { return Has(EntityIndex) ? &Dense[Sparse[EntityIndex]] : nullptr; }
+    const T* Get(Uint32 EntityIndex) const { return Has(EntityIndex) ? &Dense[Sparse[EntityIndex]] : nullptr; }
+
+    size_t Size() const { return Dense.size(); }
+    T* Data() { return Dense.data(); }
+    const T* Data() const { return Dense.data(); }
+    Uint32 EntityAt(size_t Slot) const { return DenseEntity[Slot]; }
+
+    void Clear()
+    {
+        Dense.clear();
+        DenseEntity.clear();
+        Sparse.clear();
+    }
+};
+
+// Castle numbers as structure-of-arrays, one packed slot per castle (Sparse maps entity index
+// to slot, as in ComponentArray), so the monthly tick is a few straight loops over int columns
+// that the compiler can vectorize. Every MonthsPerSeason-th tick also brings in the harvest.
+class CastleEconomy
+{
+    static constexpr Uint32 Absent = 0xFFFFFFFF;
+    std::vector<Uint32> DenseEntity;
+    std::vector<Uint32> Sparse;
+    Uint64 Month = 0;
+
+    template <typename Fn>
+    void ForEachColumn(Fn&& F)
+    {
+        F(Gold); F(Food); F(GoldPerMonth); F(FoodPerSeason); F(Soldier); F(SoldierMorale); F(Order);
+        F(Duration); F(Spears); F(Polearms); F(Bows); F(Horses); F(NumOfPerson); F(Version);
+    }
+
+public:
+    static constexpr int MonthsPerSeason = 3;
+    // Gold and food saturate here; the headroom to INT_MAX covers one month's income or harvest.
+    static constexpr int MaxStock = 1000000000;
+    // Monthly upkeep is one food per this many soldiers, rounded down. Division by a constant
+    // compiles to a multiply and shift that is exact for every int, and still vectorizes.
+    static constexpr int SoldiersPerFood = 10;
+    // Morale heads for one of these each month, rising slowly and falling fast; order follows
+    // morale the same way.
+    static constexpr int MoraleArmed = 100; // Fed, and there is equipment for every soldier
+    static constexpr int MoraleFed = 90;
+    static constexpr int MoraleStarving = 30;
+    static constexpr int MoraleRise = 2;
+    static constexpr int MoraleFall = 10;
+    static constexpr int OrderRise = 1;
+    static constexpr int OrderFall = 2;
+
+    std::vector<int> Gold;
+    std::vector<int> Food;
+    std::vector<int> GoldPerMonth;
+    std::vector<int> FoodPerSeason;
+    std::vector<int> Soldier;
+    std::vector<int> SoldierMorale;
+    std::vector<int> Order;
+    std::vector<int> Duration;
+    std::vector<int> Spears;
+    std::vector<int> Polearms;
+    std::vector<int> Bows;
+    std::vector<int> Horses;
+    std::vector<int> NumOfPerson;
+    std::vector<Uint32> Version; // Bumped whenever the castle's numbers change, so views can refresh
+
+    void Add(Uint32 EntityIndex, const CastleStats& Stats)
+    {
+        if (EntityIndex >= Sparse.size())
+            Sparse.resize(EntityIndex + 1, Absent);
+        if (Sparse[EntityIndex] != Absent)
+            Remove(EntityIndex);
+
+        Sparse[EntityIndex] = static_cast<Uint32>(DenseEntity.size());
+        DenseEntity.push_back(EntityIndex);
+        Gold.push_back(Stats.Gold);
+        Food.push_back(Stats.Food);
+        GoldPerMonth.push_back(Stats.GoldPerMonth);
+        FoodPerSeason.push_back(Stats.FoodPerSeason);
+        Soldier.push_back(Stats.Soldier);
+        SoldierMorale.push_back(Stats.SoldierMorale);
+        Order.push_back(Stats.Order);
+        Duration.push_back(Stats.Duration);
+        Spears.push_back(Stats.Spears);
+        Polearms.push_back(Stats.Polearms);
+        Bows.push_back(Stats.Bows);
+        Horses.push_back(Stats.Horses);
+        NumOfPerson.push_back(Stats.NumOfPerson);
+        Version.push_back(0);
+    }
+
+    void Remove(Uint32 EntityIndex)
+    {
+        if (!Has(EntityIndex))
+            return;
+        Uint32 slot = Sparse[EntityIndex];
+        Uint32 last = static_cast<Uint32>(DenseEntity.size() - 1);
+        ForEachColumn([&](auto& Column)
+            {
+                Column[slot] = Column[last];
+                Column.pop_back();
+            });
+        if (slot != last)
+        {
+            DenseEntity[slot] = DenseEntity[last];
+            Sparse[DenseEntity[slot]] = slot;
+        }
+        DenseEntity.pop_back();
+        Sparse[EntityIndex] = Absent;
+    }
+
+    bool Has(Uint32 EntityIndex) const { return EntityIndex < Sparse.size() && Sparse[EntityIndex] != Absent; }
+    size_t Size() const { return DenseEntity.size(); }
+
+    CastleStats Get(Uint32 EntityIndex) const
+    {
+        CastleStats stats;
+        if (!Has(EntityIndex))
+            return stats;
+        Uint32 k = Sparse[EntityIndex];
+        stats.Gold = Gold[k];
+        stats.Food = Food[k];
+        stats.Order = Order[k];
+        stats.Duration = Duration[k];
+        stats.Soldier = Soldier[k];
+        stats.SoldierMorale = SoldierMorale[k];
+        stats.Spears = Spears[k];
+        stats.Polearms = Polearms[k];
+        stats.Bows = Bows[k];
+        stats.Horses = Horses[k];
+        stats.GoldPerMonth = GoldPerMonth[k];
+        stats.FoodPerSeason = FoodPerSeason[k];
+        stats.NumOfPerson = NumOfPerson[k];
+        return stats;
+    }
+
+    Uint32 GetVersion(Uint32 EntityIndex) const { return Has(EntityIndex) ? Version[Sparse[EntityIndex]] : 0; }
+
+    // One month for every castle: income, the harvest at season end, food upkeep, then morale
+    // and order drift. Branches are plain selects, so each loop vectorizes.
+    void Tick()
+    {
+        const int n = static_cast<int>(DenseEntity.size());
+        AddCapped(Gold.data(), GoldPerMonth.data(), Version.data(), n);
+        if (++Month % MonthsPerSeason == 0)
+            AddCapped(Food.data(), FoodPerSeason.data(), Version.data(), n);
+        Upkeep(Food.data(), SoldierMorale.data(), Order.data(), Version.data(), Soldier.data(), Spears.data(), Polearms.data(), Bows.data(), Horses.data(), n);
+    }
+
+private:
+    // The loops live in functions of their own so that __restrict on the parameters tells the
+    // compiler the columns never overlap; otherwise it gives up on the alias checks.
+    // Each loop bumps the version of the castles whose numbers it changed.
+    static void AddCapped(int* __restrict pStock, const int* __restrict pIncome, Uint32* __restrict pVersion, int Count)
+    {
+        for (int k = 0; k < Count; ++k)
+        {
+            int stock = std::min(pStock[k] + pIncome[k], MaxStock);
+            pVersion[k] += stock != pStock[k];
+            pStock[k] = stock;
+        }
+    }
+
+    static void Upkeep(int* __restrict pFood, int* __restrict pMorale, int* __restrict pOrder, Uint32* __restrict pVersion, const int* __restrict pSoldier,
+        const int* __restrict pSpears, const int* __restrict pPolearms, const int* __restrict pBows, const int* __restrict pHorses, int Count)
+    {
+        for (int k = 0; k < Count; ++k)
+        {
+            int left = pFood[k] - pSoldier[k] / SoldiersPerFood;
+            int food = std::max(left, 0);
+            // Each kind counts up to MaxStock, so the sum fits in Uint32 however big the armoury.
+            Uint32 armed = static_cast<Uint32>(std::clamp(pSpears[k], 0, MaxStock)) + static_cast<Uint32>(std::clamp(pPolearms[k], 0, MaxStock))
+                + static_cast<Uint32>(std::clamp(pBows[k], 0, MaxStock)) + static_cast<Uint32>(std::clamp(pHorses[k], 0, MaxStock));
+            int target = left < 0 ? MoraleStarving : armed >= static_cast<Uint32>(std::max(pSoldier[k], 0)) ? MoraleArmed : MoraleFed;
+            int morale = pMorale[k] + std::clamp(target - pMorale[k], -MoraleFall, MoraleRise);
+            int order = pOrder[k] + std::clamp(morale - pOrder[k], -OrderFall, OrderRise);
+            pVersion[k] += (food != pFood[k]) | (morale != pMorale[k]) | (order != pOrder[k]);
+            pFood[k] = food;
+            pMorale[k] = morale;
+            pOrder[k] = order;
+        }
+    }
+
+public:
+    void Clear()
+    {
+        ForEachColumn([](auto& Column) { Column.clear(); });
+        DenseEntity.clear();
+        Sparse.clear();
+    }
+};
+
+// Entity ids are recycled through a free list; each reuse bumps the generation so old
+// handles are detected as stale instead of aliasing the new entity.
+class EntityWorld
+{
+    std::vector<Uint32> Generations;
+    std::vector<Uint8> Alive;
+    std::vector<Uint32> FreeList;
+    size_t AliveCount = 0;
 
 public:
-    Castle(Faction a_Fac)
+    ComponentArray<CellComponent> Cells;
+    ComponentArray<SpriteComponent> Sprites;
+    ComponentArray<FactionComponent> Factions;
+    ComponentArray<CastleComponent> Castles;
+    CastleEconomy Economy; // Numbers of the entities in Castles
+
+    Entity Create()
+    {
+        Uint32 index;
+        if (!FreeList.empty())
+        {
+            index = FreeList.back();
+            FreeList.pop_back();
+        }
+        else
+        {
+            index = static_cast<Uint32>(Generations.size());
+            Generations.push_back(0);
+            Alive.push_back(0);
+        }
+        Alive[index] = 1;
+        ++AliveCount;
+        return { index, Generations[index] };
+    }
+
+    bool IsAlive(Entity e) const
+    {
+        return e.Index < Generations.size() && Alive[e.Index] && Generations[e.Index] == e.Generation;
+    }
+
+    Entity HandleOf(Uint32 Index) const
+    {
+        if (Index >= Generations.size() || !Alive[Index])
+            return {};
+        return { Index, Generations[Index] };
+    }
+
+    void Destroy(Entity e)
     {
-        Fac = a_Fac;
-        SrcRect = { 224,192 + 32 * static_cast<float>(Fac), 32,32 };
+        if (!IsAlive(e))
+            return;
+        Cells.Remove(e.Index);
+        Sprites.Remove(e.Index);
+        Factions.Remove(e.Index);
+        Castles.Remove(e.Index);
+        Economy.Remove(e.Index);
+        Alive[e.Index] = 0;
+        ++Generations[e.Index];
+        FreeList.push_back(e.Index);
+        --AliveCount;
     }
-    void InitData(std::string a_Name, int a_Gold, int a_Food)
+
+    // Destroys every entity but keeps generations, so handles from before stay stale.
+    void Clear()
     {
-        Name = a_Name;
-        Gold = a_Gold;
-        Food = a_Food;
+        for (Uint32 i = 0; i < Generations.size(); ++i)
+            Destroy(HandleOf(i));
     }
+
+    size_t Size() const { return AliveCount; }
 };
 
 struct ClickableArea
@@ -207,17 +606,209 @@ struct ClickableArea
     }
 };
 
-struct Tile : public ClickableArea
+// Fixed-size square block of the map, stored structure-of-arrays with a ChunkSize row stride.
+// Cells past the right or bottom map edge are left zero.
+struct TileChunk
+{
+    static constexpr int ChunkShift = 6;
+    static constexpr int ChunkSize = 1 << ChunkShift;
+    static constexpr int ChunkMask = ChunkSize - 1;
+    static constexpr int CellCount = ChunkSize * ChunkSize;
+
+    int Id = 0;
+    Uint64 LastUsedFrame = 0;
+    bool bDirty = false; // Edited since the last save; never evicted
+    Uint16 BitmapIdx[CellCount];
+    Uint16 Bits[CellCount];
+};
+
+// Chunked structure-of-arrays tile storage. Only chunks streamed in around the camera are resident;
+// cells of missing chunks read as bitmap 0 and are skipped by rendering and editing.
+// Destination rects are derived from the grid position, source rects come from a
+// lookup table shared by every tile with the same bitmap index.
+class TileStore
 {
+public:
     static const int SourceBitmapTileSize = 16;
-    int BitmapIdx = 0;
+    static const Uint16 CastleBitmapIdx = 202;
+
+    enum : Uint16
+    {
+        TileBits_PropertyMask = 0x00FF,
+        TileBits_Castle = 1 << 8,
+        TileBits_NoPlace = 1 << 9,
+    };
+
+    enum ChunkState : Uint8
+    {
+        Chunk_Absent,
+        Chunk_Requested,
+        Chunk_Resident,
+    };
+
+    int W = 0;
+    int H = 0;
+    int ChunksX = 0;
+    int ChunksY = 0;
+    std::vector<std::unique_ptr<TileChunk>> Chunks; // ChunksX * ChunksY, null unless resident
+    std::vector<Uint8> States;
+    int ResidentCount = 0;
+    int RequestedCount = 0; // Chunks in Chunk_Requested
+    std::vector<SDL_FRect> SrcRects; // Indexed by bitmap index
+
+    void Clear() { Reset(0, 0); }
+
+    void Reset(int a_W, int a_H)
+    {
+        W = a_W;
+        H = a_H;
+        ChunksX = (W + TileChunk::ChunkMask) >> TileChunk::ChunkShift;
+        ChunksY = (H + TileChunk::ChunkMask) >> TileChunk::ChunkShift;
+        Chunks.clear();
+        Chunks.resize(static_cast<size_t>(ChunksX) * ChunksY);
+        States.assign(Chunks.size(), Chunk_Absent);
+        ResidentCount = 0;
+        RequestedCount = 0;
+    }
+
+    int Size() const { return W * H; }
+    bool IsValid(int mapIdx) const { return mapIdx >= 0 && mapIdx < Size(); }
+
+    static int ChunkOf(int i, int j, int ChunksX) { return (j >> TileChunk::ChunkShift) * ChunksX + (i >> TileChunk::ChunkShift); }
+    static int LocalOf(int i, int j) { return ((j & TileChunk::ChunkMask) << TileChunk::ChunkShift) + (i & TileChunk::ChunkMask); }
+
+    TileChunk* FindChunk(int mapIdx) const
+    {
+        return IsValid(mapIdx) ? Chunks[ChunkOf(mapIdx % W, mapIdx / W, ChunksX)].get() : nullptr;
+    }
+
+    bool IsResident(int mapIdx) const { return FindChunk(mapIdx) != nullptr; }
+
+    Uint16 GetBitmapIdx(int mapIdx) const
+    {
+        const TileChunk* pChunk = FindChunk(mapIdx);
+        return pChunk ? pChunk->BitmapIdx[LocalOf(mapIdx % W, mapIdx / W)] : 0;
+    }
+
+    Uint16 GetBits(int mapIdx) const
+    {
+        const TileChunk* pChunk = FindChunk(mapIdx);
+        return pChunk ? pChunk->Bits[LocalOf(mapIdx % W, mapIdx / W)] : static_cast<Uint16>(TileBits_NoPlace);
+    }
+
+    // Returns false when the chunk is not resident; the edit is then dropped.
+    bool SetBitmapIdx(int mapIdx, Uint16 bitmapIdx)
+    {
+        TileChunk* pChunk = FindChunk(mapIdx);
+        if (!pChunk)
+            return false;
+        pChunk->BitmapIdx[LocalOf(mapIdx % W, mapIdx / W)] = bitmapIdx;
+        pChunk->bDirty = true;
+        return true;
+    }
+
+    void Install(TileChunk* pChunk)
+    {
+        if (!Chunks[pChunk->Id])
+            ++ResidentCount;
+        Chunks[pChunk->Id].reset(pChunk);
+        States[pChunk->Id] = Chunk_Resident;
+    }
+
+    void Evict(int chunkId)
+    {
+        if (!Chunks[chunkId])
+            return;
+        Chunks[chunkId].reset();
+        States[chunkId] = Chunk_Absent;
+        --ResidentCount;
+    }
+
+    // Drops requests that a stopped streamer will never answer.
+    void ForgetRequests()
+    {
+        for (Uint8& state : States)
+            if (state == Chunk_Requested)
+                state = Chunk_Absent;
+        RequestedCount = 0;
+    }
+
+    // Row-major copy of the whole map: resident chunks win over pSource, which holds the file contents.
+    void Gather(const Uint16* pSource, std::vector<Uint16>& Out) const
+    {
+        Out.assign(pSource, pSource + Size());
+        for (const std::unique_ptr<TileChunk>& pChunk : Chunks)
+        {
+            if (!pChunk)
+                continue;
+            int x0 = (pChunk->Id % ChunksX) << TileChunk::ChunkShift;
+            int y0 = (pChunk->Id / ChunksX) << TileChunk::ChunkShift;
+            int w = std::min(TileChunk::ChunkSize, W - x0);
+            int h = std::min(TileChunk::ChunkSize, H - y0);
+            for (int y = 0; y < h; ++y)
+                std::memcpy(&Out[static_cast<size_t>(y0 + y) * W + x0], &pChunk->BitmapIdx[y << TileChunk::ChunkShift], w * sizeof(Uint16));
+        }
+    }
+
+    void BuildSrcRects(float AtlasW, float AtlasH)
+    {
+        int cols = static_cast<int>(AtlasW) / SourceBitmapTileSize;
+        int rows = static_cast<int>(AtlasH) / SourceBitmapTileSize;
+        SrcRects.resize(static_cast<size_t>(cols) * rows);
+        for (int b = 0; b < cols * rows; ++b)
+        {
+            SrcRects[b] = {
+                static_cast<float>((b % cols) * SourceBitmapTileSize),
+                static_cast<float>((b / cols) * SourceBitmapTileSize),
+                static_cast<float>(SourceBitmapTileSize),
+                static_cast<float>(SourceBitmapTileSize) };
+        }
+    }
+
+    static SDL_FRect GetDestRect(int i, int j)
+    {
+        float destX = i * HORIZONTAL_SPACING + ((j & 1) ? ODD_ROW_X_OFFSET : 0.0f);
+        float destY = j * VERTICAL_SPACING;
+        return { destX, destY, HEX_FLAT_TOP_WIDTH, HEX_FLAT_TOP_HEIGHT };
+    }
+
+    SDL_FRect GetDestRect(int mapIdx) const { return GetDestRect(mapIdx % W, mapIdx / W); }
+
+    const SDL_FRect& GetSrcRect(int mapIdx) const
+    {
+        static const SDL_FRect emptyRect = { 0,0,0,0 };
+        Uint16 b = GetBitmapIdx(mapIdx);
+        return b < SrcRects.size() ? SrcRects[b] : emptyRect;
+    }
+
+    bool CanPlaceHere(int mapIdx) const { return (GetBits(mapIdx) & TileBits_NoPlace) == 0; }
+    bool IsCastle(int mapIdx) const { return (GetBits(mapIdx) & TileBits_Castle) != 0; }
+    int GetProperty(int mapIdx) const { return GetBits(mapIdx) & TileBits_PropertyMask; }
+};
+
+// Lightweight view of one cell of a TileStore.
+struct Tile
+{
+    static const int SourceBitmapTileSize = TileStore::SourceBitmapTileSize;
+
+    const TileStore* pStore = nullptr;
     int MapIdx = 0;
-    int Property = 0;
-    SDL_FRect TexSrcRect = { 0,0,0,0 };
 
-    virtual bool CanPlaceHere() const { return true; }
+    Tile(const TileStore* a_pStore, int a_MapIdx) : pStore(a_pStore), MapIdx(a_MapIdx) {}
+
+    int GetBitmapIdx() const { return pStore->GetBitmapIdx(MapIdx); }
+    int GetProperty() const { return pStore->GetProperty(MapIdx); }
+    const SDL_FRect& GetSrcRect() const { return pStore->GetSrcRect(MapIdx); }
+    SDL_FRect GetDestRect() const { return pStore->GetDestRect(MapIdx); }
+    bool CanPlaceHere() const { return pStore->CanPlaceHere(MapIdx); }
+    bool IsCastle() const { return pStore->IsCastle(MapIdx); }
 
-    bool IsInHex(float px, float py, float hex_side_length)
+    bool IsInHex(float px, float py, float hex_side_length) const
+    {
+        return IsInHex(GetDestRect(), px, py, hex_side_length);
+    }
+
+    static bool IsInHex(const SDL_FRect& TexDestRect, float px, float py, float hex_side_length)
     {
         float hex_bb_x = TexDestRect.x;
         float hex_bb_y = TexDestRect.y;
@@ -230,22 +821,17 @@ struct Tile : public ClickableArea
         float rel_x = px - hex_center_x;
         float rel_y = py - hex_center_y;
 
-        if (abs(rel_x) > hex_bb_w / 2.0f || abs(rel_y) > hex_bb_h / 2.0f) {
+        if (std::abs(rel_x) > hex_bb_w / 2.0f || std::abs(rel_y) > hex_bb_h / 2.0f) {
             return false;
         }
 
-        float half_height = hex_side_length * sqrtf(3.0f) / 2.0f;
+        float half_height = hex_side_length * SQRT_3 / 2.0f;
         float outer_width_half = hex_side_length;
 
-        return abs(rel_y) <= half_height && abs(rel_y) <= sqrtf(3.0f) * (outer_width_half - abs(rel_x));
+        return std::abs(rel_y) <= half_height && std::abs(rel_y) <= SQRT_3 * (outer_width_half - std::abs(rel_x));
     }
 };
 
-struct CastleTile : public Tile
-{
-    bool CanPlaceHere() const override { return false; }
-};
-
 enum class HAlign { Left, Center, Right };
 
 class RenderInterface
@@ -255,10 +841,26 @@ protected:
 public:
     virtual RenderInterface* CreateRenderer(Viewport* VP) = 0;
     virtual void RenderText(const std::string& message, float x, float y, float availableWidth, HAlign align = HAlign::Left) = 0;
-    virtual void RenderObject(Object* obj, Tile* pTile, bool bSelected) = 0;
-    virtual void RenderTile(Tile* pTile, int X, int Y, int MapW, int MapH, bool bSelectedIndex) = 0;
+    virtual void RenderSprite(Texture* pTex, const SDL_FRect& SrcRect, const SDL_FRect& DestRect, bool bSelected) = 0;
+    virtual void RenderTile(const Tile& tile, const SDL_FRect& DestRect, int X, int Y, int MapW, int MapH, bool bSelectedIndex) = 0;
     virtual void RenderTexture(Texture* pTex, SDL_FRect* pDestRect) = 0;
     virtual void RenderBox(SDL_FRect* pFRect, Uint8 R, Uint8 G, Uint8 B, Uint8 A) = 0;
+    virtual void RenderGeometry(Texture* pTex, const SDL_Vertex* pVertices, int NumVertices, const int* pIndices, int NumIndices) = 0;
+    // Restricts drawing to pClip in screen pixels (widened to whole pixels); nullptr lifts it.
+    virtual void SetClipRect(const SDL_FRect* pClip) = 0;
+
+    // Offscreen targets for cached drawing. Between Begin/EndRenderTarget all drawing goes into the
+    // target, which starts out cleared to transparent; contents are lost on a render device reset.
+    virtual bool CreateRenderTarget(Texture& Out, int W, int H) = 0;
+    virtual void DestroyRenderTarget(Texture& Target) = 0;
+    virtual void BeginRenderTarget(Texture& Target) = 0;
+    virtual void EndRenderTarget() = 0;
+
+    // Persistent text labels: the text is rasterized only when it changes.
+    virtual int CreateLabel() = 0;
+    virtual void SetLabelText(int Label, const std::string& text) = 0;
+    virtual void RenderLabel(int Label, float x, float y, float availableWidth, HAlign align = HAlign::Left) = 0;
+    virtual void DestroyLabel(int Label) = 0;
 
     virtual void Destroy() = 0;
 
@@ -271,625 +873,3032 @@ public:
     Viewport* GetViewport() const { return _VP; }
 };
 
-// --- Windowing System ---
-class Window : public ClickableArea
+// --- Profiler ---
+// Nanosecond scoped zones for the main thread. Zones nest by call order and are identified by
+// (parent, name), so the hierarchy builds itself without registration. Each zone keeps its
+// per-frame total in a ring of the last HistoryFrames frames, alongside the frame time itself.
+class Profiler
 {
 public:
-    std::string Title;
-    SDL_FRect Rect;
-    RenderInterface* RI;
-    bool bShow = true;
-    bool bHovered = false;
-    Texture* pTex = nullptr;
+    static constexpr int HistoryFrames = 240;
+    static constexpr int MaxDepth = 16;
 
-    Window(const std::string& a_Title, const SDL_FRect& a_Rect, RenderInterface* a_RI) : Title(a_Title), Rect(a_Rect), RI(a_RI)
+    struct Zone
     {
-        TexDestRect = Rect;
-    }
+        const char* Name = nullptr;
+        int Parent = -1;
+        int Depth = 0;
+        Uint64 FrameNS = 0;    // Accumulated during the current frame
+        Uint32 FrameCalls = 0;
+        Uint32 LastCalls = 0;  // Calls in the last finished frame
+        Uint64 HistoryNS[HistoryFrames] = {};
+    };
 
-    virtual ~Window() {}
+    bool bShowOverlay = false;
 
-    void SetTexture(Texture* a_pTex)
-    {
-        pTex = a_pTex;
-    }
+private:
+    std::vector<Zone> Zones;
+    int Stack[MaxDepth] = {};
+    int Depth = 0;
 
-    void SetPosition(float x, float y)
-    {
-        Rect.x = x;
-        Rect.y = y;
-        TexDestRect.x = x;
-        TexDestRect.y = y;
-    }
+    Uint64 FrameStartNS = 0;
+    Uint64 FrameHistoryNS[HistoryFrames] = {};
+    int Cursor = 0; // Ring slot the current frame is written to
+    Uint64 FrameCount = 0;
 
-    virtual void Render(RenderInterface* a_RI)
-    {
-        if (!bShow)
-            return;
+    std::vector<Uint64> SortScratch;
+    std::vector<SDL_Vertex> GraphVertices;
+    std::vector<int> GraphIndices;
 
-        if (pTex)
+public:
+    int Begin(const char* Name)
+    {
+        // Past MaxDepth, deeper zones are attributed to the deepest tracked one.
+        int tracked = std::min(Depth, MaxDepth);
+        int parent = tracked > 0 ? Stack[tracked - 1] : -1;
+        int idx = -1;
+        for (int k = 0; k < static_cast<int>(Zones.size()); ++k)
         {
-            a_RI->RenderTexture(pTex, &Rect);
+            if (Zones[k].Parent == parent && (Zones[k].Name == Name || std::strcmp(Zones[k].Name, Name) == 0))
+            {
+                idx = k;
+                break;
+            }
         }
-        else
+        if (idx < 0)
         {
-            // Draw a default window box
-            a_RI->RenderBox(&Rect, 100, 100, 100, 200);
-        }
-        if (!Title.empty()) {
-            float centerX = Rect.x + Rect.w / 2.0f;
-            a_RI->RenderText(Title, Rect.x, Rect.y + 5, Rect.w, HAlign::Center);
-        }
-        if (bHovered) {
-            a_RI->RenderBox(&Rect, 255, 0, 0, 255);
+            idx = static_cast<int>(Zones.size());
+            Zones.emplace_back();
+            Zones.back().Name = Name;
+            Zones.back().Parent = parent;
+            Zones.back().Depth = tracked;
         }
+        if (Depth < MaxDepth)
+            Stack[Depth] = idx;
+        ++Depth;
+        return idx;
     }
 
-    virtual void Execute(GameState* pState)
+    void End(int ZoneIdx, Uint64 ElapsedNS)
     {
-        // Default implementation does nothing
+        Zones[ZoneIdx].FrameNS += ElapsedNS;
+        ++Zones[ZoneIdx].FrameCalls;
+        if (Depth > 0)
+            --Depth;
     }
-};
-
-class CastleInfoWnd : public Window
-{
-public:
-    Castle* pCastle = nullptr;
 
-    CastleInfoWnd(const std::string& a_Title, const SDL_FRect& a_Rect, RenderInterface* a_RI)
-        : Window(a_Title, a_Rect, a_RI) {
+    void BeginFrame()
+    {
+        FrameStartNS = SDL_GetTicksNS();
     }
 
-    void Init(Castle* a_pCastle)
+    // Closes the frame: zone totals and the frame time move into the ring.
+    void EndFrame()
     {
-        pCastle = a_pCastle;
+        FrameHistoryNS[Cursor] = SDL_GetTicksNS() - FrameStartNS;
+        for (Zone& z : Zones)
+        {
+            z.HistoryNS[Cursor] = z.FrameNS;
+            z.LastCalls = z.FrameCalls;
+            z.FrameNS = 0;
+            z.FrameCalls = 0;
+        }
+        Cursor = (Cursor + 1) % HistoryFrames;
+        ++FrameCount;
     }
 
-    // Overload for initial setup
-    void Init(const std::string& castleName, int gold, int food)
+    int GetHistorySize() const { return static_cast<int>(std::min<Uint64>(FrameCount, HistoryFrames)); }
+
+    // Frame time at percentile P (0..1) over the recorded history.
+    Uint64 GetFramePercentile(double P)
     {
-        // This is a bit of a hack since we don't have a real castle object yet.
+        int n = GetHistorySize();
+        if (n == 0)
+            return 0;
+        SortScratch.assign(FrameHistoryNS, FrameHistoryNS + n);
+        size_t k = static_cast<size_t>(P * (n - 1) + 0.5);
+        std::nth_element(SortScratch.begin(), SortScratch.begin() + k, SortScratch.end());
+        return SortScratch[k];
     }
 
-    void Render(RenderInterface* a_RI) override
+    void GetZoneStats(const Zone& z, double& AvgMs, double& MaxMs) const
     {
-        if (!bShow)
+        int n = GetHistorySize();
+        Uint64 sum = 0, peak = 0;
+        for (int k = 0; k < n; ++k)
+        {
+            sum += z.HistoryNS[k];
+            peak = std::max(peak, z.HistoryNS[k]);
+        }
+        AvgMs = n ? sum / 1e6 / n : 0.0;
+        MaxMs = peak / 1e6;
+    }
+
+    void RenderOverlay(RenderInterface* RI)
+    {
+        if (!bShowOverlay)
+            return;
+
+        const float x = 10.0f, lineH = 20.0f;
+        const float graphW = static_cast<float>(HistoryFrames * 2), graphH = 100.0f;
+        const double graphMaxMs = 33.3;
+        float y = 10.0f;
+        float panelH = 3 * lineH + graphH + 10.0f + Zones.size() * lineH;
+
+        // Panel background and one bar per recorded frame, oldest on the left, as a single untextured draw.
+        GraphVertices.clear();
+        GraphIndices.clear();
+        AddQuad(x - 5, y - 5, graphW + 10, panelH + 10, { 0.0f, 0.0f, 0.0f, 0.7f });
+        int n = GetHistorySize();
+        for (int k = 0; k < n; ++k)
+        {
+            int slot = (Cursor - n + k + HistoryFrames) % HistoryFrames;
+            double ms = FrameHistoryNS[slot] / 1e6;
+            float h = static_cast<float>(std::min(ms / graphMaxMs, 1.0) * graphH);
+            SDL_FColor color = ms < 16.7 ? SDL_FColor{ 0.2f, 0.9f, 0.2f, 1.0f } : ms < 33.3 ? SDL_FColor{ 0.9f, 0.8f, 0.1f, 1.0f } : SDL_FColor{ 0.9f, 0.2f, 0.2f, 1.0f };
+            AddQuad(x + k * 2.0f, y + graphH - h, 2.0f, h, color);
+        }
+        AddQuad(x, y + graphH - static_cast<float>(16.7 / graphMaxMs * graphH), graphW, 1.0f, { 1.0f, 1.0f, 1.0f, 0.5f });
+        RI->RenderGeometry(nullptr, GraphVertices.data(), static_cast<int>(GraphVertices.size()), GraphIndices.data(), static_cast<int>(GraphIndices.size()));
+        y += graphH + 10.0f;
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "Frame p50 %.2f  p95 %.2f  p99 %.2f ms (%d frames)",
+            GetFramePercentile(0.50) / 1e6, GetFramePercentile(0.95) / 1e6, GetFramePercentile(0.99) / 1e6, n);
+        RI->RenderText(line, x, y, 0.0f);
+        y += lineH;
+        std::snprintf(line, sizeof(line), "%-28s %8s %8s %6s", "Zone", "avg ms", "max ms", "calls");
+        RI->RenderText(line, x, y, 0.0f);
+        y += lineH;
+        RenderZones(RI, -1, x, y, lineH);
+    }
+
+private:
+    void AddQuad(float qx, float qy, float qw, float qh, const SDL_FColor& Color)
+    {
+        int base = static_cast<int>(GraphVertices.size());
+        GraphVertices.push_back({ { qx, qy }, Color, { 0, 0 } });
+        GraphVertices.push_back({ { qx + qw, qy }, Color, { 0, 0 } });
+        GraphVertices.push_back({ { qx + qw, qy + qh }, Color, { 0, 0 } });
+        GraphVertices.push_back({ { qx, qy + qh }, Color, { 0, 0 } });
+        GraphIndices.insert(GraphIndices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+    }
+
+    // Depth-first, so children are listed indented under their parent.
+    void RenderZones(RenderInterface* RI, int Parent, float x, float& y, float lineH)
+    {
+        for (const Zone& z : Zones)
+        {
+            if (z.Parent != Parent)
+                continue;
+            double avgMs, maxMs;
+            GetZoneStats(z, avgMs, maxMs);
+            char line[160];
+            std::snprintf(line, sizeof(line), "%*s%-*s %8.3f %8.3f %6u", z.Depth * 2, "", 28 - z.Depth * 2, z.Name, avgMs, maxMs, z.LastCalls);
+            RI->RenderText(line, x, y, 0.0f);
+            y += lineH;
+            RenderZones(RI, static_cast<int>(&z - Zones.data()), x, y, lineH);
+        }
+    }
+};
+Profiler Prof;
+
+// Times its enclosing scope into the profiler zone Name (a string literal).
+class ProfileScope
+{
+    int ZoneIdx;
+    Uint64 StartNS;
+public:
+    explicit ProfileScope(const char* Name) : ZoneIdx(Prof.Begin(Name)), StartNS(SDL_GetTicksNS()) {}
+    ~ProfileScope() { Prof.End(ZoneIdx, SDL_GetTicksNS() - StartNS); }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+// --- Windowing System ---
+// Phases of a routed UI event: Capture runs from the outermost ancestor down to the target's
+// parent, Target on the window under the pointer, then Bubble back up to the outermost one.
+enum class UIPhase
+{
+    Capture,
+    Target,
+    Bubble,
+};
+
+// Uniform grid over a window's children in the window's local coordinates. Each cell lists
+// the children overlapping it front to back, so a hit test only looks at the few children
+// under the pointer instead of all of them. Local coordinates keep it valid when the owner moves.
+class UIHitGrid
+{
+    static constexpr float CellSize = 64.0f;
+    int CellsX = 0;
+    int CellsY = 0;
+    std::vector<std::vector<int>> Cells;
+    const std::vector<int> Empty;
+
+    int CellX(float x) const { return std::clamp(static_cast<int>(std::floor(x / CellSize)), 0, CellsX - 1); }
+    int CellY(float y) const { return std::clamp(static_cast<int>(std::floor(y / CellSize)), 0, CellsY - 1); }
+
+public:
+    bool bDirty = true;
+
+    // pRects are the children's local rects, back to front.
+    void Build(float W, float H, const SDL_FRect* pRects, int Count)
+    {
+        CellsX = std::max(1, static_cast<int>(std::ceil(W / CellSize)));
+        CellsY = std::max(1, static_cast<int>(std::ceil(H / CellSize)));
+        Cells.assign(static_cast<size_t>(CellsX) * CellsY, {});
+        for (int k = Count - 1; k >= 0; --k)
+        {
+            const SDL_FRect& r = pRects[k];
+            if (r.x > W || r.y > H || r.x + r.w < 0 || r.y + r.h < 0)
+                continue; // Entirely outside the owner, so clipped away and never hit
+            for (int cy = CellY(r.y); cy <= CellY(r.y + r.h); ++cy)
+                for (int cx = CellX(r.x); cx <= CellX(r.x + r.w); ++cx)
+                    Cells[cy * CellsX + cx].push_back(k);
+        }
+        bDirty = false;
+    }
+
+    const std::vector<int>& Query(float x, float y) const
+    {
+        if (Cells.empty())
+            return Empty;
+        return Cells[CellY(y) * CellsX + CellX(x)];
+    }
+};
+
+// A window and its child windows. Rect is in screen coordinates; a child's rect is given
+// relative to its parent and converted when it is added. Children are kept back to front by
+// ZOrder, drawn clipped to their parent and hit-tested through the parent's UIHitGrid.
+// Each window composes its own content into a render target once and blits it afterwards;
+// Invalidate (or IsContentStale) makes it compose again.
+class Window : public ClickableArea
+{
+public:
+    std::string Title;
+    SDL_FRect Rect;
+    RenderInterface* RI;
+    bool bShow = true;
+    bool bHovered = false;         // The pointer is over this window or one of its children
+    bool bHighlightOnHover = true;
+    bool bDrawBackground = true;
+    TextureHandle Tex;
+    int TitleLabel = -1;
+
+    Window* pParent = nullptr;
+    std::vector<Window*> Children; // Owned, back to front
+    int ZOrder = 0;
+
+private:
+    UIHitGrid HitGrid;
+    std::vector<SDL_FRect> ChildRects;
+
+    Texture Cache{ nullptr, 0, 0 }; // Composed content at the window's size
+    bool bDirty = true;
+    Uint32 ComposedTexVersion = 0; // Tex's version when composed, so a late upload recomposes
+
+    void MoveBy(float dx, float dy)
+    {
+        Rect.x += dx;
+        Rect.y += dy;
+        TexDestRect.x = Rect.x;
+        TexDestRect.y = Rect.y;
+        for (Window* pChild : Children)
+            pChild->MoveBy(dx, dy);
+    }
+
+    void RebuildHitGrid()
+    {
+        ChildRects.resize(Children.size());
+        for (size_t k = 0; k < Children.size(); ++k)
+        {
+            const SDL_FRect& r = Children[k]->Rect;
+            ChildRects[k] = { r.x - Rect.x, r.y - Rect.y, r.w, r.h };
+        }
+        HitGrid.Build(Rect.w, Rect.h, ChildRects.data(), static_cast<int>(ChildRects.size()));
+    }
+
+public:
+    Window(const std::string& a_Title, const SDL_FRect& a_Rect, RenderInterface* a_RI) : Title(a_Title), Rect(a_Rect), RI(a_RI)
+    {
+        TexDestRect = Rect;
+        TitleLabel = RI->CreateLabel();
+    }
+
+    virtual ~Window()
+    {
+        for (Window* pChild : Children)
+            delete pChild;
+        RI->DestroyRenderTarget(Cache);
+        RI->DestroyLabel(TitleLabel);
+    }
+
+    void Invalidate()
+    {
+        bDirty = true;
+        Redraw.Invalidate();
+    }
+
+    void SetTitle(const std::string& a_Title)
+    {
+        if (Title == a_Title)
+            return;
+        Title = a_Title;
+        Invalidate();
+    }
+
+    void SetHovered(bool a_bHovered)
+    {
+        if (bHovered == a_bHovered)
+            return;
+        bHovered = a_bHovered;
+        if (bHighlightOnHover)
+            Invalidate();
+    }
+
+    // Render targets lose their contents when the device resets them and become invalid when
+    // the device itself is reset; either way the whole tree composes again on its next frame.
+    void ResetCaches(bool bReleaseTargets)
+    {
+        if (bReleaseTargets)
+            RI->DestroyRenderTarget(Cache);
+        Invalidate();
+        for (Window* pChild : Children)
+            pChild->ResetCaches(bReleaseTargets);
+    }
+
+    void SetTexture(TextureHandle a_Tex)
+    {
+        Tex = std::move(a_Tex);
+    }
+
+    void SetPosition(float x, float y)
+    {
+        MoveBy(x - Rect.x, y - Rect.y);
+        if (pParent)
+            pParent->HitGrid.bDirty = true;
+    }
+
+    // Takes ownership of pChild, whose Rect is relative to this window. Among equal ZOrder,
+    // later children are in front.
+    Window* AddChild(Window* pChild, int a_ZOrder = 0)
+    {
+        pChild->pParent = this;
+        pChild->ZOrder = a_ZOrder;
+        pChild->MoveBy(Rect.x, Rect.y);
+        auto it = std::upper_bound(Children.begin(), Children.end(), a_ZOrder,
+            [](int z, const Window* pWnd) { return z < pWnd->ZOrder; });
+        Children.insert(it, pChild);
+        HitGrid.bDirty = true;
+        return pChild;
+    }
+
+    // Deepest shown window containing (x, y), or nullptr when the point is outside this one.
+    Window* HitTest(float x, float y)
+    {
+        if (!bShow || !IsIn(x, y))
+            return nullptr;
+        if (!Children.empty())
+        {
+            if (HitGrid.bDirty)
+                RebuildHitGrid();
+            for (int k : HitGrid.Query(x - Rect.x, y - Rect.y))
+            {
+                if (Window* pHit = Children[k]->HitTest(x, y))
+                    return pHit;
+            }
+        }
+        return this;
+    }
+
+    // Draws this window, then its children clipped to it (and to pClip, its parent's clip).
+    void RenderTree(RenderInterface* a_RI, const SDL_FRect* pClip)
+    {
+        if (!bShow)
+            return;
+        Render(a_RI);
+        if (Children.empty())
+            return;
+
+        SDL_FRect clip = Rect;
+        if (pClip)
+        {
+            float x0 = std::max(clip.x, pClip->x);
+            float y0 = std::max(clip.y, pClip->y);
+            float x1 = std::min(clip.x + clip.w, pClip->x + pClip->w);
+            float y1 = std::min(clip.y + clip.h, pClip->y + pClip->h);
+            clip = { x0, y0, x1 - x0, y1 - y0 };
+        }
+        if (clip.w <= 0 || clip.h <= 0)
+            return;
+        a_RI->SetClipRect(&clip);
+        for (Window* pChild : Children)
+            pChild->RenderTree(a_RI, &clip);
+        a_RI->SetClipRect(pClip);
+    }
+
+    // Blits the composed content, composing it first when it is missing or out of date.
+    virtual void Render(RenderInterface* a_RI)
+    {
+        if (!bShow)
+            return;
+
+        if (!Cache.bReady && !a_RI->CreateRenderTarget(Cache, static_cast<int>(std::ceil(Rect.w)), static_cast<int>(std::ceil(Rect.h))))
+        {
+            Compose(a_RI, Rect); // No target to cache into, so draw straight to the screen
+            return;
+        }
+        if (Tex && Tex.Get()->Version != ComposedTexVersion)
+            bDirty = true;
+        if (bDirty || IsContentStale())
+        {
+            ProfileScope zone("Window::Compose");
+            a_RI->BeginRenderTarget(Cache);
+            Compose(a_RI, { 0, 0, Rect.w, Rect.h });
+            a_RI->EndRenderTarget();
+            ComposedTexVersion = Tex ? Tex.Get()->Version : 0;
+            bDirty = false;
+        }
+        a_RI->RenderTexture(&Cache, &Rect);
+    }
+
+    // Draws the window's content into Area: the window's rect inside its render target, or on
+    // screen when there is no target.
+    virtual void Compose(RenderInterface* a_RI, const SDL_FRect& Area)
+    {
+        SDL_FRect area = Area;
+        if (bDrawBackground)
+        {
+            if (Tex)
+            {
+                a_RI->RenderTexture(Tex.Get(), &area);
+            }
+            else
+            {
+                // Draw a default window box
+                a_RI->RenderBox(&area, 100, 100, 100, 200);
+            }
+        }
+        if (!Title.empty()) {
+            a_RI->SetLabelText(TitleLabel, Title);
+            a_RI->RenderLabel(TitleLabel, area.x, area.y + 5, area.w, HAlign::Center);
+        }
+        if (bHovered && bHighlightOnHover) {
+            a_RI->RenderBox(&area, 255, 0, 0, 255);
+        }
+    }
+
+    // Lets a window that mirrors outside data ask for a compose when that data has moved on.
+    virtual bool IsContentStale() const { return false; }
+
+    // Routed pointer events; returning true stops the route. By default a window consumes left
+    // clicks aimed at it and runs Execute on release, and lets everything else pass.
+    virtual bool OnEvent(const SDL_Event& event, UIPhase Phase, GameState* pState)
+    {
+        if (Phase != UIPhase::Target)
+            return false;
+        if (event.type == SDL_EVENT_MOUSE_BUTTON_UP && event.button.button == SDL_BUTTON_LEFT)
+        {
+            Execute(pState);
+            return true;
+        }
+        return event.type == SDL_EVENT_MOUSE_BUTTON_DOWN && event.button.button == SDL_BUTTON_LEFT;
+    }
+
+    virtual void Execute(GameState* pState)
+    {
+        // Default implementation does nothing
+    }
+};
+
+class CastleInfoWnd : public Window
+{
+    int NameLabel = -1;
+    int GoldLabel = -1;
+    int FoodLabel = -1;
+
+    // What the composed content shows, to tell when the bound castle has changed since.
+    bool bShowingCastle = false;
+    Entity ShownCastle;
+    Uint32 ShownVersion = 0;
+
+    const EntityWorld* pWorld = nullptr;
+    Entity hCastle;
+
+    // A stale handle (castle destroyed or map reloaded) simply shows no details.
+    const CastleComponent* GetCastle() const
+    {
+        return pWorld && pWorld->IsAlive(hCastle) ? pWorld->Castles.Get(hCastle.Index) : nullptr;
+    }
+
+public:
+
+    CastleInfoWnd(const std::string& a_Title, const SDL_FRect& a_Rect, RenderInterface* a_RI)
+        : Window(a_Title, a_Rect, a_RI) {
+        NameLabel = RI->CreateLabel();
+        GoldLabel = RI->CreateLabel();
+        FoodLabel = RI->CreateLabel();
+    }
+
+    ~CastleInfoWnd()
+    {
+        RI->DestroyLabel(NameLabel);
+        RI->DestroyLabel(GoldLabel);
+        RI->DestroyLabel(FoodLabel);
+    }
+
+    void Init(const EntityWorld* a_pWorld, Entity a_hCastle)
+    {
+        pWorld = a_pWorld;
+        hCastle = a_hCastle;
+    }
+
+    // Overload for initial setup
+    void Init(const std::string& castleName, int gold, int food)
+    {
+        // This is a bit of a hack since we don't have a real castle object yet.
+    }
+
+    bool IsContentStale() const override
+    {
+        const CastleComponent* pCastle = GetCastle();
+        if (!pCastle)
+            return bShowingCastle;
+        return !bShowingCastle || ShownCastle != hCastle || ShownVersion != pWorld->Economy.GetVersion(hCastle.Index);
+    }
+
+    void Compose(RenderInterface* a_RI, const SDL_FRect& Area) override
+    {
+        Window::Compose(a_RI, Area); // Window background
+
+        const CastleComponent* pCastle = GetCastle();
+        bShowingCastle = pCastle != nullptr;
+        if (pCastle) {
+            float currentY = Area.y + 10; // Start with top padding
+            const float lineSpacing = 20; // Adjust as needed
+            const float leftX = Area.x + 10; // Left padding
+
+            CastleStats stats = pWorld->Economy.Get(hCastle.Index);
+            ShownCastle = hCastle;
+            ShownVersion = pWorld->Economy.GetVersion(hCastle.Index);
+            a_RI->SetLabelText(NameLabel, pCastle->Name);
+            a_RI->SetLabelText(GoldLabel, u8"골드: " + std::to_string(stats.Gold));
+            a_RI->SetLabelText(FoodLabel, u8"식량: " + std::to_string(stats.Food));
+
+            a_RI->RenderLabel(NameLabel, leftX, currentY, 0.0f, HAlign::Left);
+            currentY += lineSpacing;
+            a_RI->RenderLabel(GoldLabel, leftX, currentY, 0.0f, HAlign::Left);
+            currentY += lineSpacing;
+            a_RI->RenderLabel(FoodLabel, leftX, currentY, 0.0f, HAlign::Left);
+        }
+    }
+};
+
+// Invisible full-screen root of a game state's window tree. Tracks the hovered path and
+// routes pointer events to the window under the pointer.
+class UIRoot : public Window
+{
+    GameState* pState;
+    Window* pHovered = nullptr;
+    std::vector<Window*> Path; // Scratch: target first, outermost ancestor last
+
+    Window* Pick(float x, float y)
+    {
+        Window* pHit = HitTest(x, y);
+        return pHit == this ? nullptr : pHit;
+    }
+
+public:
+    UIRoot(const Viewport& VP, RenderInterface* a_RI, GameState* a_pState)
+        : Window("", { 0, 0, static_cast<float>(VP.WIDTH), static_cast<float>(VP.HEIGHT) }, a_RI), pState(a_pState) {}
+
+    void Render(RenderInterface*) override {}
+
+    void RenderWindows()
+    {
+        RenderTree(RI, nullptr);
+        RI->SetClipRect(nullptr);
+    }
+
+    // Moves the hovered path to the windows under (x, y).
+    void UpdateHover(float x, float y)
+    {
+        Window* pHit = Pick(x, y);
+        if (pHit == pHovered)
+            return;
+        for (Window* pWnd = pHovered; pWnd && pWnd != this; pWnd = pWnd->pParent)
+            pWnd->SetHovered(false);
+        for (Window* pWnd = pHit; pWnd && pWnd != this; pWnd = pWnd->pParent)
+            pWnd->SetHovered(true);
+        pHovered = pHit;
+        Redraw.Invalidate();
+    }
+
+    // Capture from the outermost ancestor down, then the target, then bubble back up.
+    // Returns whether a window consumed the event.
+    bool Dispatch(const SDL_Event& event, float x, float y)
+    {
+        Window* pTarget = Pick(x, y);
+        if (!pTarget)
+            return false;
+        Path.clear();
+        for (Window* pWnd = pTarget; pWnd != this; pWnd = pWnd->pParent)
+            Path.push_back(pWnd);
+
+        for (size_t k = Path.size() - 1; k > 0; --k)
+        {
+            if (Path[k]->OnEvent(event, UIPhase::Capture, pState))
+                return true;
+        }
+        if (pTarget->OnEvent(event, UIPhase::Target, pState))
+            return true;
+        for (size_t k = 1; k < Path.size(); ++k)
+        {
+            if (Path[k]->OnEvent(event, UIPhase::Bubble, pState))
+                return true;
+        }
+        return false;
+    }
+};
+// --- End Windowing System ---
+
+// Free-rectangle (guillotine) packer over RGBA atlas pages. Freed regions go back to their page,
+// and a page with nothing left on it is released.
+class TextureAtlas
+{
+    static constexpr int PageSize = 1024;
+    static constexpr int Padding = 1;
+
+    struct Page
+    {
+        SDL_Texture* Tex = nullptr;
+        int Size = 0;
+        int Live = 0;
+        std::vector<SDL_Rect> Free;
+    };
+    std::vector<Page> Pages;
+    std::vector<Uint32> ClearStrip;
+
+public:
+    void Destroy()
+    {
+        for (auto& page : Pages)
+            SDL_DestroyTexture(page.Tex);
+        Pages.clear();
+    }
+
+    size_t GetPageCount() const { return Pages.size(); }
+
+    size_t GetPageBytes() const
+    {
+        size_t bytes = 0;
+        for (const Page& page : Pages)
+            bytes += static_cast<size_t>(page.Size) * page.Size * 4;
+        return bytes;
+    }
+
+    // Best short-side fit over all free rects. Opens a page when nothing fits; bitmaps larger
+    // than PageSize get a page of their own size.
+    bool Allocate(SDL_Renderer* renderer, int w, int h, SDL_Rect& outRect, SDL_Texture*& outPage, float& outPageSize)
+    {
+        int pw = w + Padding;
+        int ph = h + Padding;
+        Page* pBest = nullptr;
+        size_t bestFree = 0;
+        int bestFit = INT_MAX;
+        for (Page& page : Pages)
+        {
+            for (size_t k = 0; k < page.Free.size(); ++k)
+            {
+                const SDL_Rect& f = page.Free[k];
+                int fit = std::min(f.w - pw, f.h - ph);
+                if (fit >= 0 && fit < bestFit)
+                {
+                    pBest = &page;
+                    bestFree = k;
+                    bestFit = fit;
+                }
+            }
+        }
+
+        if (!pBest)
+        {
+            int size = std::max({ PageSize, pw, ph });
+            SDL_Texture* tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, size, size);
+            if (!tex)
+            {
+                std::cerr << "Failed to create texture atlas page: " << SDL_GetError() << std::endl;
+                return false;
+            }
+            // Clear once so filtering at a bitmap's edge samples transparent padding, not garbage.
+            std::vector<Uint8> clear(static_cast<size_t>(size) * size * 4, 0);
+            SDL_UpdateTexture(tex, nullptr, clear.data(), size * 4);
+            SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+            Pages.push_back({ tex, size, 0, { { 0, 0, size, size } } });
+            pBest = &Pages.back();
+            bestFree = 0;
+        }
+
+        SDL_Rect f = pBest->Free[bestFree];
+        pBest->Free[bestFree] = pBest->Free.back();
+        pBest->Free.pop_back();
+
+        // Split the leftover L-shape along the shorter leftover side, keeping the bigger piece whole.
+        SDL_Rect right, bottom;
+        if (f.w - pw < f.h - ph)
+        {
+            right = { f.x + pw, f.y, f.w - pw, ph };
+            bottom = { f.x, f.y + ph, f.w, f.h - ph };
+        }
+        else
+        {
+            right = { f.x + pw, f.y, f.w - pw, f.h };
+            bottom = { f.x, f.y + ph, pw, f.h - ph };
+        }
+        if (right.w > 0 && right.h > 0)
+            pBest->Free.push_back(right);
+        if (bottom.w > 0 && bottom.h > 0)
+            pBest->Free.push_back(bottom);
+
+        ++pBest->Live;
+        outRect = { f.x, f.y, w, h };
+        outPage = pBest->Tex;
+        outPageSize = static_cast<float>(pBest->Size);
+        return true;
+    }
+
+    // Copies the bitmap in and clears its padding, which may hold a previous occupant's pixels.
+    void Write(SDL_Texture* pPage, const SDL_Rect& Rect, const SDL_Surface* pRGBA)
+    {
+        SDL_UpdateTexture(pPage, &Rect, pRGBA->pixels, pRGBA->pitch);
+        ClearStrip.assign(std::max(Rect.w, Rect.h) + Padding, 0);
+        SDL_Rect right = { Rect.x + Rect.w, Rect.y, Padding, Rect.h + Padding };
+        SDL_Rect bottom = { Rect.x, Rect.y + Rect.h, Rect.w, Padding };
+        SDL_UpdateTexture(pPage, &right, ClearStrip.data(), 4);
+        SDL_UpdateTexture(pPage, &bottom, ClearStrip.data(), Rect.w * 4);
+    }
+
+    void Release(SDL_Texture* pPage, const SDL_Rect& Rect)
+    {
+        for (size_t k = 0; k < Pages.size(); ++k)
+        {
+            Page& page = Pages[k];
+            if (page.Tex != pPage)
+                continue;
+            if (--page.Live == 0)
+            {
+                SDL_DestroyTexture(page.Tex);
+                Pages.erase(Pages.begin() + k);
+            }
+            else
+                page.Free.push_back({ Rect.x, Rect.y, Rect.w + Padding, Rect.h + Padding });
+            return;
+        }
+    }
+};
+
+struct ResourceStats
+{
+    size_t ResidentBytes = 0; // Bitmap pixels held in atlas pages
+    size_t AtlasBytes = 0;    // Atlas pages themselves
+    size_t BudgetBytes = 0;
+    int Resident = 0;
+    Uint64 Hits = 0;          // GetTex calls served by a resident texture
+    Uint64 Misses = 0;        // GetTex calls that got the placeholder
+    Uint64 Loads = 0;
+    Uint64 Evictions = 0;
+    double TotalLoadMs = 0;   // Request to upload, summed over Loads
+    double MaxLoadMs = 0;
+
+    double AverageLoadMs() const { return Loads ? TotalLoadMs / Loads : 0.0; }
+};
+
+// Textures are registered by name and loaded on first use: a miss queues the bitmap for a worker
+// thread, and Update copies decoded bitmaps into atlas pages on the render thread within a
+// per-frame time budget. Texture objects live until Destroy and draw a placeholder while not
+// resident, so pointers to them stay valid across eviction. Once resident bytes exceed the
+// budget, textures without handles that were not used last frame are evicted, oldest use first.
+class ResourceManager
+{
+    enum Residency : Uint8
+    {
+        Res_Unloaded,
+        Res_Loading,
+        Res_Resident,
+        Res_Failed,
+    };
+
+    struct Entry
+    {
+        std::string Name;
+        Texture* pTex = nullptr;
+        Residency State = Res_Unloaded;
+        int RefCount = 0;
+        Uint64 LastUsedFrame = 0;
+        Uint64 RequestNS = 0;
+        SDL_Texture* pPage = nullptr;
+        SDL_Rect Rect = { 0,0,0,0 };
+    };
+
+    struct DecodeJob
+    {
+        int ResID = -1;
+        std::string Name;
+        SDL_Surface* pSurface = nullptr;
+    };
+
+    static constexpr Uint64 UploadBudgetNS = 2 * SDL_NS_PER_MS;
+    static constexpr int MaxWorkers = 4;
+
+    std::vector<Entry> Entries;
+    std::unordered_map<std::string, int> ByName;
+
+    // Shared with the workers, guarded by QueueMutex.
+    std::mutex QueueMutex;
+    std::condition_variable QueueReady;
+    std::deque<DecodeJob> Pending;
+    std::deque<DecodeJob> Decoded;
+    bool bQuit = false;
+    std::vector<std::thread> Workers;
+
+    TextureAtlas Atlas;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* Placeholder = nullptr;
+    Uint64 Frame = 0;
+    int LoadsInFlight = 0; // Requested and not yet installed
+    ResourceStats Stats;
+
+public:
+    // Built-in bitmaps, registered in this order by LoadResources.
+    enum
+    {
+        ResID_SpaceShip = 0,
+        ResID_Alien = 1,
+        ResID_Tile = 2,
+        ResID_Army = 3,
+        ResID_GameMenu = 4,
+        ResID_CastleMenu = 5,
+    };
+
+    ResourceManager() { Stats.BudgetBytes = 64 * 1024 * 1024; }
+
+    // Registers the built-in bitmaps and starts the workers; nothing is decoded until first use.
+    void LoadResources(RenderInterface* RI)
+    {
+        renderer = static_cast<SDL_Renderer*>(RI->GetRenderer());
+
+        Placeholder = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, 1, 1);
+        const Uint8 grey[4] = { 64, 64, 64, 255 };
+        SDL_UpdateTexture(Placeholder, nullptr, grey, sizeof(grey));
+
+        Register("spaceship.bmp", 100, 100);
+        Register("alien.bmp", 60, 60);
+        Register("buch-outdoor.bmp", 384, 192);
+        Register("Army.bmp", 448, 448);
+        Register("GameMenu.bmp", 150, 208);
+        Register("CastleMenu.bmp", 88, 214);
+
+        bQuit = false;
+        int workerCount = std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1, MaxWorkers);
+        for (int k = 0; k < workerCount; ++k)
+            Workers.emplace_back(&ResourceManager::WorkerMain, this);
+    }
+
+    // W/H is the layout size. Registering a known name returns its existing id.
+    int Register(const std::string& Name, float Width, float Height)
+    {
+        auto it = ByName.find(Name);
+        if (it != ByName.end())
+            return it->second;
+        Entry entry;
+        entry.Name = Name;
+        entry.pTex = new Texture(Placeholder, Width, Height);
+        Entries.push_back(std::move(entry));
+        return ByName[Name] = static_cast<int>(Entries.size()) - 1;
+    }
+
+    int Find(const std::string& Name) const
+    {
+        auto it = ByName.find(Name);
+        return it != ByName.end() ? it->second : -1;
+    }
+
+    TextureHandle Acquire(int ResID) { return TextureHandle(ResID); }
+    TextureHandle Acquire(const std::string& Name, float Width, float Height) { return TextureHandle(Register(Name, Width, Height)); }
+
+    void AddRef(int ResID)
+    {
+        if (ResID >= 0 && ResID < static_cast<int>(Entries.size()))
+            ++Entries[ResID].RefCount;
+    }
+
+    void Release(int ResID)
+    {
+        if (ResID >= 0 && ResID < static_cast<int>(Entries.size()))
+            --Entries[ResID].RefCount;
+    }
+
+    // Marks the texture used this frame; a miss starts loading it and returns the placeholder view.
+    Texture& GetTex(int ResID)
+    {
+        Entry& entry = Entries[ResID];
+        entry.LastUsedFrame = Frame;
+        if (entry.State == Res_Resident)
+        {
+            ++Stats.Hits;
+            return *entry.pTex;
+        }
+        ++Stats.Misses;
+        if (entry.State == Res_Unloaded)
+            RequestLoad(ResID);
+        return *entry.pTex;
+    }
+
+    void SetBudget(size_t Bytes) { Stats.BudgetBytes = Bytes; }
+    const ResourceStats& GetStats() const { return Stats; }
+    bool IsLoading() const { return LoadsInFlight > 0; }
+
+    // Once per frame on the render thread: uploads decoded bitmaps within the time budget
+    // (at least one per call), then evicts down to the memory budget.
+    void Update()
+    {
+        Uint64 start = SDL_GetTicksNS();
+        while (true)
+        {
+            DecodeJob job;
+            {
+                std::lock_guard<std::mutex> lock(QueueMutex);
+                if (Decoded.empty())
+                    break;
+                job = std::move(Decoded.front());
+                Decoded.pop_front();
+            }
+            Install(job);
+            Redraw.Invalidate();
+            if (SDL_GetTicksNS() - start >= UploadBudgetNS)
+                break;
+        }
+
+        EvictOverBudget();
+        Stats.AtlasBytes = Atlas.GetPageBytes();
+        ++Frame;
+    }
+
+    void Destroy()
+    {
+        {
+            std::lock_guard<std::mutex> lock(QueueMutex);
+            bQuit = true;
+        }
+        QueueReady.notify_all();
+        for (std::thread& worker : Workers)
+            worker.join();
+        Workers.clear();
+        for (DecodeJob& job : Decoded)
+            SDL_DestroySurface(job.pSurface);
+        Decoded.clear();
+        Pending.clear();
+        LoadsInFlight = 0;
+
+        if (Entries.size() > 0)
+        {
+            std::cout << "Textures: " << Stats.Loads << " loads (avg " << Stats.AverageLoadMs() << " ms, max " << Stats.MaxLoadMs
+                << " ms), " << Stats.Hits << " hits, " << Stats.Misses << " misses, " << Stats.Evictions << " evictions" << std::endl;
+        }
+        for (Entry& entry : Entries)
+            delete entry.pTex;
+        Entries.clear();
+        ByName.clear();
+        Atlas.Destroy();
+        if (Placeholder)
+        {
+            SDL_DestroyTexture(Placeholder);
+            Placeholder = nullptr;
+        }
+        size_t budget = Stats.BudgetBytes;
+        Stats = ResourceStats();
+        Stats.BudgetBytes = budget;
+    }
+
+    ~ResourceManager()
+    {
+        Destroy();
+    }
+
+private:
+    void RequestLoad(int ResID)
+    {
+        Entry& entry = Entries[ResID];
+        entry.State = Res_Loading;
+        entry.RequestNS = SDL_GetTicksNS();
+        ++LoadsInFlight;
+        {
+            std::lock_guard<std::mutex> lock(QueueMutex);
+            Pending.push_back({ ResID, entry.Name, nullptr });
+        }
+        QueueReady.notify_one();
+    }
+
+    void WorkerMain()
+    {
+        std::unique_lock<std::mutex> lock(QueueMutex);
+        while (true)
+        {
+            QueueReady.wait(lock, [this] { return bQuit || !Pending.empty(); });
+            if (bQuit)
+                return;
+            DecodeJob job = std::move(Pending.front());
+            Pending.pop_front();
+            lock.unlock();
+
+            if (SDL_Surface* bmp = SDL_LoadBMP(job.Name.c_str()))
+            {
+                job.pSurface = SDL_ConvertSurface(bmp, SDL_PIXELFORMAT_RGBA32);
+                SDL_DestroySurface(bmp);
+            }
+            if (!job.pSurface)
+                std::cerr << "Failed to load BMP: " << job.Name << " - " << SDL_GetError() << std::endl;
+
+            lock.lock();
+            Decoded.push_back(std::move(job));
+        }
+    }
+
+    void Install(DecodeJob& job)
+    {
+        Entry& entry = Entries[job.ResID];
+        --LoadsInFlight;
+        float pageSize = 0;
+        if (job.pSurface && Atlas.Allocate(renderer, job.pSurface->w, job.pSurface->h, entry.Rect, entry.pPage, pageSize))
+        {
+            Atlas.Write(entry.pPage, entry.Rect, job.pSurface);
+            SDL_FRect region = { static_cast<float>(entry.Rect.x), static_cast<float>(entry.Rect.y), static_cast<float>(entry.Rect.w), static_cast<float>(entry.Rect.h) };
+            entry.pTex->SetRegion(entry.pPage, region, pageSize, pageSize);
+            entry.State = Res_Resident;
+
+            double ms = (SDL_GetTicksNS() - entry.RequestNS) / 1000000.0;
+            ++Stats.Loads;
+            ++Stats.Resident;
+            Stats.ResidentBytes += GetBytes(entry);
+            Stats.TotalLoadMs += ms;
+            Stats.MaxLoadMs = std::max(Stats.MaxLoadMs, ms);
+        }
+        else
+            entry.State = Res_Failed; // Keeps the placeholder instead of retrying every frame
+        SDL_DestroySurface(job.pSurface);
+        job.pSurface = nullptr;
+    }
+
+    static size_t GetBytes(const Entry& entry) { return static_cast<size_t>(entry.Rect.w) * entry.Rect.h * 4; }
+
+    void EvictOverBudget()
+    {
+        if (Stats.ResidentBytes <= Stats.BudgetBytes)
+            return;
+
+        std::vector<std::pair<Uint64, int>> candidates;
+        for (int id = 0; id < static_cast<int>(Entries.size()); ++id)
+        {
+            const Entry& entry = Entries[id];
+            if (entry.State == Res_Resident && entry.RefCount == 0 && entry.LastUsedFrame < Frame)
+                candidates.emplace_back(entry.LastUsedFrame, id);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for (size_t k = 0; k < candidates.size() && Stats.ResidentBytes > Stats.BudgetBytes; ++k)
+        {
+            Entry& entry = Entries[candidates[k].second];
+            Atlas.Release(entry.pPage, entry.Rect);
+            entry.pTex->Reset(Placeholder);
+            entry.pPage = nullptr;
+            entry.State = Res_Unloaded;
+            Stats.ResidentBytes -= GetBytes(entry);
+            --Stats.Resident;
+            ++Stats.Evictions;
+        }
+    }
+};
+
+ResourceManager RM; // Define RM here, after ResourceManager class
+
+TextureHandle::TextureHandle(int a_ResID) : ResID(a_ResID) { RM.AddRef(ResID); }
+TextureHandle::TextureHandle(const TextureHandle& Other) : ResID(Other.ResID) { RM.AddRef(ResID); }
+TextureHandle::~TextureHandle() { RM.Release(ResID); }
+Texture* TextureHandle::Get() const { return ResID >= 0 ? &RM.GetTex(ResID) : nullptr; }
+
+// Glyphs are rasterized once into shared atlas pages and strings are drawn as one geometry batch.
+class GlyphAtlas
+{
+    static const int PageSize = 512;
+    static const int GlyphPadding = 1;
+
+    struct Glyph
+    {
+        int Page = -1;
+        SDL_FRect SrcRect = { 0,0,0,0 };
+        int Advance = 0;
+    };
+
+    SDL_Renderer* renderer = nullptr;
+    TTF_Font* font = nullptr;
+
+    std::vector<SDL_Texture*> Pages;
+    int PenX = 0;
+    int PenY = 0;
+    int RowHeight = 0;
+
+    std::unordered_map<Uint32, Glyph> Glyphs;
+
+    // Scratch buffers reused across strings to avoid per-call allocation.
+    std::vector<SDL_Vertex> Vertices;
+    std::vector<int> Indices;
+
+public:
+    void Init(SDL_Renderer* a_renderer, TTF_Font* a_font)
+    {
+        renderer = a_renderer;
+        font = a_font;
+
+        // Pre-warm printable ASCII; Hangul syllables are added on first use.
+        for (Uint32 ch = 32; ch < 127; ++ch)
+            GetGlyph(ch);
+    }
+
+    void Destroy()
+    {
+        for (auto& page : Pages)
+            SDL_DestroyTexture(page);
+        Pages.clear();
+        Glyphs.clear();
+        PenX = PenY = RowHeight = 0;
+    }
+
+    float GetLineHeight() const
+    {
+        return font ? static_cast<float>(TTF_GetFontHeight(font)) : 0.0f;
+    }
+
+    static Uint32 DecodeUTF8(const std::string& str, size_t& i)
+    {
+        unsigned char c = static_cast<unsigned char>(str[i++]);
+        int extra = 0;
+        Uint32 ch = c;
+        if (c >= 0xF0) { ch = c & 0x07; extra = 3; }
+        else if (c >= 0xE0) { ch = c & 0x0F; extra = 2; }
+        else if (c >= 0xC0) { ch = c & 0x1F; extra = 1; }
+        else if (c >= 0x80) return 0xFFFD;
+
+        for (; extra > 0; --extra)
+        {
+            if (i >= str.size() || (static_cast<unsigned char>(str[i]) & 0xC0) != 0x80)
+                return 0xFFFD;
+            ch = (ch << 6) | (static_cast<unsigned char>(str[i++]) & 0x3F);
+        }
+        return ch;
+    }
+
+    float MeasureText(const std::string& message)
+    {
+        float width = 0.0f;
+        for (size_t i = 0; i < message.size();)
+        {
+            const Glyph* pGlyph = GetGlyph(DecodeUTF8(message, i));
+            if (pGlyph)
+                width += pGlyph->Advance;
+        }
+        return width;
+    }
+
+    // Draws the string with its top-left at (x, y) and returns the covered rect.
+    SDL_FRect DrawText(const std::string& message, float x, float y, SDL_Color color)
+    {
+        Vertices.clear();
+        Indices.clear();
+
+        SDL_FColor fColor = { color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f };
+        float penX = x;
+        int page = -1;
+
+        for (size_t i = 0; i < message.size();)
+        {
+            const Glyph* pGlyph = GetGlyph(DecodeUTF8(message, i));
+            if (!pGlyph)
+                continue;
+
+            if (pGlyph->Page != page)
+            {
+                Flush(page);
+                page = pGlyph->Page;
+            }
+
+            const SDL_FRect& src = pGlyph->SrcRect;
+            float u0 = src.x / PageSize;
+            float v0 = src.y / PageSize;
+            float u1 = (src.x + src.w) / PageSize;
+            float v1 = (src.y + src.h) / PageSize;
+
+            int base = static_cast<int>(Vertices.size());
+            Vertices.push_back({ { penX,         y         }, fColor, { u0, v0 } });
+            Vertices.push_back({ { penX + src.w, y         }, fColor, { u1, v0 } });
+            Vertices.push_back({ { penX + src.w, y + src.h }, fColor, { u1, v1 } });
+            Vertices.push_back({ { penX,         y + src.h }, fColor, { u0, v1 } });
+            Indices.insert(Indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+
+            penX += pGlyph->Advance;
+        }
+        Flush(page);
+
+        return { x, y, penX - x, GetLineHeight() };
+    }
+
+private:
+    void Flush(int page)
+    {
+        if (page >= 0 && !Indices.empty())
+            SDL_RenderGeometry(renderer, Pages[page], Vertices.data(), static_cast<int>(Vertices.size()), Indices.data(), static_cast<int>(Indices.size()));
+        Vertices.clear();
+        Indices.clear();
+    }
+
+    const Glyph* GetGlyph(Uint32 ch)
+    {
+        auto it = Glyphs.find(ch);
+        if (it != Glyphs.end())
+            return it->second.Page >= 0 || it->second.Advance > 0 ? &it->second : nullptr;
+
+        Glyph& glyph = Glyphs[ch];
+        if (!font)
+            return nullptr;
+
+        int advance = 0;
+        if (TTF_GetGlyphMetrics(font, ch, nullptr, nullptr, nullptr, nullptr, &advance))
+            glyph.Advance = advance;
+
+        SDL_Surface* glyphSurface = TTF_RenderGlyph_Blended(font, ch, { 255, 255, 255, 255 });
+        if (!glyphSurface)
+            return glyph.Advance > 0 ? &glyph : nullptr;
+
+        SDL_Surface* rgba = SDL_ConvertSurface(glyphSurface, SDL_PIXELFORMAT_RGBA32);
+        SDL_DestroySurface(glyphSurface);
+        if (!rgba)
+        {
+            std::cerr << "Failed to convert glyph surface: " << SDL_GetError() << std::endl;
+            return glyph.Advance > 0 ? &glyph : nullptr;
+        }
+
+        SDL_Rect dest;
+        if (Allocate(rgba->w, rgba->h, dest))
+        {
+            SDL_UpdateTexture(Pages.back(), &dest, rgba->pixels, rgba->pitch);
+            glyph.Page = static_cast<int>(Pages.size()) - 1;
+            glyph.SrcRect = { static_cast<float>(dest.x), static_cast<float>(dest.y), static_cast<float>(dest.w), static_cast<float>(dest.h) };
+        }
+        SDL_DestroySurface(rgba);
+
+        return glyph.Page >= 0 || glyph.Advance > 0 ? &glyph : nullptr;
+    }
+
+    // Shelf packing: fill rows left to right, open a new page when the current one is full.
+    bool Allocate(int w, int h, SDL_Rect& outRect)
+    {
+        if (w + GlyphPadding > PageSize || h + GlyphPadding > PageSize)
+            return false;
+
+        if (!Pages.empty() && PenX + w + GlyphPadding > PageSize)
+        {
+            PenX = 0;
+            PenY += RowHeight;
+            RowHeight = 0;
+        }
+        if (Pages.empty() || PenY + h + GlyphPadding > PageSize)
+        {
+            SDL_Texture* page = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, PageSize, PageSize);
+            if (!page)
+            {
+                std::cerr << "Failed to create glyph atlas page: " << SDL_GetError() << std::endl;
+                return false;
+            }
+            SDL_SetTextureBlendMode(page, SDL_BLENDMODE_BLEND);
+            Pages.push_back(page);
+            PenX = PenY = RowHeight = 0;
+        }
+
+        outRect = { PenX, PenY, w, h };
+        PenX += w + GlyphPadding;
+        RowHeight = std::max(RowHeight, h + GlyphPadding);
+        return true;
+    }
+};
+
+class SDLRenderInterface : public RenderInterface
+{
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    bool bHeadless; // Hidden window on the offscreen/dummy video driver with the software renderer
+
+    TTF_Font* font;
+    SDL_Color textColor = { 255, 255, 255, 255 }; // White color for text
+    GlyphAtlas Glyphs;
+
+    struct Label
+    {
+        std::string Text;
+        SDL_Texture* Tex = nullptr;
+        SDL_FRect Rect = { 0,0,0,0 };
+        size_t Bytes = 0;
+        bool bUsed = false;
+        std::list<int>::iterator LRUIt;
+    };
+    std::vector<Label> Labels;
+    std::vector<int> FreeLabels;
+    std::list<int> LabelLRU; // Rasterized labels, most recently drawn first
+    size_t LabelBytes = 0;
+    size_t LabelMemoryCap = 4 * 1024 * 1024;
+
+public:
+    explicit SDLRenderInterface(bool a_bHeadless = false) : window(nullptr), renderer(nullptr), bHeadless(a_bHeadless), font(nullptr) {}
+
+    RenderInterface* CreateRenderer(Viewport* VP) override
+    {
+        if (bHeadless)
+            SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen,dummy");
+        if (!SDL_Init(SDL_INIT_VIDEO))
+        {
+            std::cerr << "SDL_Init failed: " << SDL_GetError() << std::endl;
+            return nullptr;
+        }
+
+        window = SDL_CreateWindow("Hexagon Map Game", VP->WIDTH, VP->HEIGHT, bHeadless ? SDL_WINDOW_HIDDEN : 0);
+        if (!window)
+        {
+            std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << std::endl;
+            SDL_Quit();
+            return nullptr;
+        }
+
+        renderer = SDL_CreateRenderer(window, bHeadless ? SDL_SOFTWARE_RENDERER : nullptr);
+        if (!renderer)
+        {
+            std::cerr << "SDL_CreateRenderer failed: " << SDL_GetError() << std::endl;
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return nullptr;
+        }
+        _VP = VP;
+
+        if (!TTF_Init())
+        {
+            std::cerr << "TTF_Init failed: " << SDL_GetError() << std::endl;
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return nullptr;
+        }
+
+        font = TTF_OpenFont("NotoSansKR-Medium.ttf", 12);
+        if (!font)
+            std::cerr << "Failed to load font: NotoSansKR-Medium.ttf - " << SDL_GetError() << std::endl;
+
+        Glyphs.Init(renderer, font);
+
+        return this;
+    }
+
+    bool HasFont() const { return font != nullptr; }
+
+    void Destroy() override
+    {
+        for (auto& label : Labels)
+            if (label.Tex)
+                SDL_DestroyTexture(label.Tex);
+        Labels.clear();
+        FreeLabels.clear();
+        LabelLRU.clear();
+        LabelBytes = 0;
+
+        Glyphs.Destroy();
+        if (font)
+        {
+            TTF_CloseFont(font);
+            font = nullptr;
+        }
+        TTF_Quit();
+
+        if (renderer)
+        {
+            SDL_DestroyRenderer(renderer);
+            renderer = nullptr;
+        }
+        if (window)
+        {
+            SDL_DestroyWindow(window);
+            window = nullptr;
+        }
+        SDL_Quit();
+    }
+
+    void RenderText(const std::string& message, float x, float y, float availableWidth, HAlign align = HAlign::Left) override
+    {
+        float renderX = x;
+        if (align != HAlign::Left)
+        {
+            float textW = Glyphs.MeasureText(message);
+            if (align == HAlign::Center) {
+                renderX = x + (availableWidth - textW) / 2.0f;
+            }
+            else if (align == HAlign::Right) {
+                renderX = x + availableWidth - textW;
+            }
+        }
+
+        SDL_FRect textRect = Glyphs.DrawText(message, renderX, y, textColor);
+        if (DM.bShowObjectRect)
+        {
+            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+            SDL_RenderRect(renderer, &textRect);
+        }
+    }
+
+    int CreateLabel() override
+    {
+        int id;
+        if (!FreeLabels.empty())
+        {
+            id = FreeLabels.back();
+            FreeLabels.pop_back();
+        }
+        else
+        {
+            id = static_cast<int>(Labels.size());
+            Labels.emplace_back();
+        }
+        Labels[id].bUsed = true;
+        return id;
+    }
+
+    void SetLabelText(int id, const std::string& text) override
+    {
+        if (id < 0 || id >= static_cast<int>(Labels.size()) || !Labels[id].bUsed)
+            return;
+        Label& label = Labels[id];
+        if (label.Text == text)
+            return;
+        label.Text = text;
+        ReleaseLabelTexture(id);
+    }
+
+    void RenderLabel(int id, float x, float y, float availableWidth, HAlign align = HAlign::Left) override
+    {
+        if (id < 0 || id >= static_cast<int>(Labels.size()) || !Labels[id].bUsed)
+            return;
+        Label& label = Labels[id];
+        if (label.Text.empty())
+            return;
+
+        if (!label.Tex)
+        {
+            label.Tex = CreateTextTexture(label.Text, &label.Rect, 0.0f, 0.0f);
+            if (!label.Tex)
+                return;
+            label.Bytes = static_cast<size_t>(label.Rect.w * label.Rect.h) * 4;
+            LabelBytes += label.Bytes;
+            LabelLRU.push_front(id);
+            label.LRUIt = LabelLRU.begin();
+            EvictLabels(id);
+        }
+        else
+        {
+            LabelLRU.splice(LabelLRU.begin(), LabelLRU, label.LRUIt);
+        }
+
+        SDL_FRect textRect = label.Rect;
+        textRect.x = x;
+        if (align == HAlign::Center) {
+            textRect.x = x + (availableWidth - textRect.w) / 2.0f;
+        }
+        else if (align == HAlign::Right) {
+            textRect.x = x + availableWidth - textRect.w;
+        }
+        textRect.y = y;
+
+        SDL_RenderTexture(renderer, label.Tex, nullptr, &textRect);
+        if (DM.bShowObjectRect)
+        {
+            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+            SDL_RenderRect(renderer, &textRect);
+        }
+    }
+
+    void DestroyLabel(int id) override
+    {
+        if (id < 0 || id >= static_cast<int>(Labels.size()) || !Labels[id].bUsed)
+            return;
+        ReleaseLabelTexture(id);
+        Labels[id] = Label();
+        FreeLabels.push_back(id);
+    }
+
+    void RenderSprite(Texture* pTex, const SDL_FRect& SrcRect, const SDL_FRect& DestRect, bool bSelectedIndex) override
+    {
+        SDL_FRect src = pTex->PageRect(SrcRect);
+        SDL_RenderTexture(renderer, pTex->Tex, &src, &DestRect);
+
+        if (bSelectedIndex)
+        {
+            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+            SDL_RenderRect(renderer, &DestRect);
+        }
+        if (DM.bShowObjectRect)
+        {
+            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+            SDL_RenderRect(renderer, &DestRect);
+        }
+    }
+
+    void RenderTile(const Tile& tile, const SDL_FRect& DestRect, int X, int Y, int MapW, int MapH, bool bSelectedIndex) override
+    {
+        Texture& tileTex = RM.GetTex(ResourceManager::ResID_Tile);
+        SDL_FRect src = tileTex.PageRect(tile.GetSrcRect());
+        SDL_RenderTexture(renderer, tileTex.Tex, &src, &DestRect);
+
+        if (DM.bShowObjectRect)
+        {
+            //SDL_SetRenderDrawColor(renderer, 0, 255, 255, 200);
+
+            //float hex_center_x = DestRect.x + DestRect.w / 2.0f;
+            //float hex_center_y = DestRect.y + DestRect.h / 2.0f;
+
+            //float s = HEX_SIDE_LENGTH;
+            //float h_half = HEX_SIDE_LENGTH * sqrtf(3.0f) / 2.0f;
+
+            //SDL_FPoint vertices[6];
+            //vertices[0] = { hex_center_x + s,          hex_center_y };
+            //vertices[1] = { hex_center_x + s * 0.5f,   hex_center_y + h_half };
+            //vertices[2] = { hex_center_x - s * 0.5f,   hex_center_y + h_half };
+            //vertices[3] = { hex_center_x - s,          hex_center_y };
+            //vertices[4] = { hex_center_x - s * 0.5f,   hex_center_y - h_half };
+            //vertices[5] = { hex_center_x + s * 0.5f,   hex_center_y - h_half };
+
+            //for (int k = 0; k < 6; ++k)
+            //{
+            //    SDL_RenderLine(renderer, vertices[k].x, vertices[k].y,
+            //        vertices[(k + 1) % 6].x, vertices[(k + 1) % 6].y);
+            //}
+        }
+        if (DM.bShowObjectRect)
+        {
+            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
+            SDL_RenderRect(renderer, &DestRect);
+            std::string str = std::to_string(X) + "," + std::to_string(Y) + " " + std::to_string(tile.GetBitmapIdx());
+            RenderText(str, DestRect.x + DestRect.w / 2.0f, DestRect.y + DestRect.h / 2.0f, 0.0f, HAlign::Center);
+        }
+
+        if (bSelectedIndex)
+        {
+            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+            SDL_RenderRect(renderer, &DestRect);
+        }
+    }
+
+    void RenderTexture(Texture* pTex, SDL_FRect* pDestRect) override
+    {
+        SDL_FRect srcRect = pTex->PageRect({ 0,0, static_cast<float>(pTex->W), static_cast<float>(pTex->H) });
+        SDL_RenderTexture(renderer, pTex->Tex, &srcRect, pDestRect);
+    }
+
+    void RenderBox(SDL_FRect* pFRect, Uint8 R, Uint8 G, Uint8 B, Uint8 A) override
+    {
+        SDL_SetRenderDrawColor(renderer, R, G, B, A);
+        SDL_RenderRect(renderer, pFRect);
+    }
+
+    void RenderGeometry(Texture* pTex, const SDL_Vertex* pVertices, int NumVertices, const int* pIndices, int NumIndices) override
+    {
+        if (NumIndices <= 0)
+            return;
+        SDL_RenderGeometry(renderer, pTex ? pTex->Tex : nullptr, pVertices, NumVertices, pIndices, NumIndices);
+    }
+
+    void SetClipRect(const SDL_FRect* pClip) override
+    {
+        if (!pClip)
+        {
+            SDL_SetRenderClipRect(renderer, nullptr);
+            return;
+        }
+        int x0 = static_cast<int>(std::floor(pClip->x));
+        int y0 = static_cast<int>(std::floor(pClip->y));
+        int x1 = static_cast<int>(std::ceil(pClip->x + pClip->w));
+        int y1 = static_cast<int>(std::ceil(pClip->y + pClip->h));
+        SDL_Rect clip = { x0, y0, x1 - x0, y1 - y0 };
+        SDL_SetRenderClipRect(renderer, &clip);
+    }
+
+    bool CreateRenderTarget(Texture& Out, int W, int H) override
+    {
+        SDL_Texture* tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, W, H);
+        if (!tex)
+        {
+            std::cerr << "Failed to create render target: " << SDL_GetError() << std::endl;
+            return false;
+        }
+        // Blending into a transparent target leaves premultiplied colour behind.
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND_PREMULTIPLIED);
+        Out.W = static_cast<float>(W);
+        Out.H = static_cast<float>(H);
+        Out.SetRegion(tex, { 0, 0, Out.W, Out.H }, Out.W, Out.H);
+        return true;
+    }
+
+    void DestroyRenderTarget(Texture& Target) override
+    {
+        if (Target.bReady)
+            SDL_DestroyTexture(Target.Tex);
+        Target.Reset(nullptr);
+    }
+
+    void BeginRenderTarget(Texture& Target) override
+    {
+        SDL_SetRenderTarget(renderer, Target.Tex);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+    }
+
+    void EndRenderTarget() override
+    {
+        SDL_SetRenderTarget(renderer, nullptr);
+    }
+
+    void PreRender() override
+    {
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+    }
+
+    void PostRender() override
+    {
+        SDL_RenderPresent(renderer);
+    }
+
+    void* GetRenderer() { return renderer; }
+    void SetWindowTitle(const std::string& title) override { SDL_SetWindowTitle(window, title.c_str()); }
+
+    SDL_Texture* CreateTextTexture(const std::string& message, SDL_FRect* outRect, float x, float y)
+    {
+        if (!font) {
+            std::cerr << "Cannot create text texture: Font not loaded." << std::endl;
+            return nullptr;
+        }
+
+        SDL_Surface* textSurface = TTF_RenderText_Blended(font, message.c_str(), strlen(message.c_str()), textColor);
+        if (!textSurface) {
+            std::cerr << "Failed to create text surface: " << SDL_GetError() << std::endl;
+            return nullptr;
+        }
+        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
+        if (!textTexture) {
+            std::cerr << "Failed to create text texture: " << SDL_GetError() << std::endl;
+            SDL_DestroySurface(textSurface);
+            return nullptr;
+        }
+
+        *outRect = { x, y, static_cast<float>(textSurface->w), static_cast<float>(textSurface->h) };
+
+        SDL_DestroySurface(textSurface);
+        return textTexture;
+    }
+
+private:
+    void ReleaseLabelTexture(int id)
+    {
+        Label& label = Labels[id];
+        if (!label.Tex)
             return;
+        SDL_DestroyTexture(label.Tex);
+        label.Tex = nullptr;
+        LabelBytes -= label.Bytes;
+        label.Bytes = 0;
+        LabelLRU.erase(label.LRUIt);
+    }
+
+    // Drops least recently drawn label textures until under the cap; their text is kept for re-rasterizing.
+    void EvictLabels(int keepId)
+    {
+        while (LabelBytes > LabelMemoryCap && !LabelLRU.empty() && LabelLRU.back() != keepId)
+            ReleaseLabelTexture(LabelLRU.back());
+    }
+};
+
+class SubSystem
+{
+public:
+    virtual void Update() = 0;
+    virtual void Render(RenderInterface* RI) = 0; // Forward declare RenderInterface
+};
+
+class InputHandler
+{
+public:
+    virtual bool HandleInput(const SDL_Event& event) = 0;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+    const Uint8* pData = nullptr;
+    size_t Size = 0;
+#ifdef _WIN32
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const std::string& Path)
+    {
+        Close();
+#ifdef _WIN32
+        hFile = CreateFileA(Path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!hMapping)
+        {
+            Close();
+            return false;
+        }
+        pData = static_cast<const Uint8*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+        Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = open(Path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+        pData = static_cast<const Uint8*>(p);
+        Size = static_cast<size_t>(st.st_size);
+#endif
+        if (!pData)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (pData) UnmapViewOfFile(pData);
+        if (hMapping) CloseHandle(hMapping);
+        if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+        hMapping = nullptr;
+        hFile = INVALID_HANDLE_VALUE;
+#else
+        if (pData) munmap(const_cast<Uint8*>(pData), Size);
+#endif
+        pData = nullptr;
+        Size = 0;
+    }
+
+    const Uint8* Data() const { return pData; }
+    size_t GetSize() const { return Size; }
+};
+
+// Binary map layout (native byte order of the saving host, so the tiles can be used straight
+// from the mapping): MapFileHeader, then Layers arrays of Width*Height Uint16 in row-major
+// order. Layer 0 holds the tile bitmap indices. ByteOrder lets a host of the other byte order
+// reject the file instead of misreading it.
+struct MapFileHeader
+{
+    char Magic[4];
+    Uint32 ByteOrder; // MapIO::ByteOrderMark as stored by the saving host
+    Uint32 Version;
+    Uint32 Width;
+    Uint32 Height;
+    Uint32 Layers;
+    Uint32 Checksum; // FNV-1a over all layer data
+};
+static_assert(sizeof(MapFileHeader) == 28, "MapFileHeader must stay packed");
+
+// Map file reading and writing, CSV (map.txt) and binary (.hxmap).
+class MapIO
+{
+public:
+    static const int MaxMapDim = 8192;
+    static constexpr const char* BinaryMagic = "HXMP";
+    static const Uint32 BinaryVersion = 2;
+    static const Uint32 ByteOrderMark = 0x01020304;
+
+    // Single pass over the whole text with std::from_chars: no per-value allocation, no exceptions.
+    // Every row must have as many columns as the first; blank lines and a trailing comma are ignored.
+    // Out is sized once from the first row's width and the line count and filled in place.
+    static bool ParseCSV(const char* pText, size_t Size, std::vector<Uint16>& Out, int& OutW, int& OutH)
+    {
+        Out.clear();
+        OutW = 0;
+        OutH = 0;
+
+        const char* p = pText;
+        const char* pEnd = pText + Size;
+        auto isEol = [](char c) { return c == '\n' || c == '\r'; };
+        auto isBlank = [](char c) { return c == ' ' || c == '\t'; };
+        auto isSpace = [&](char c) { return isEol(c) || isBlank(c); };
+
+        // Rows end at any run of '\r' and '\n', so CR, LF and CRLF files size the same way the loop below reads them.
+        // Blanks are trimmed everywhere, so a line of nothing but blanks is an empty line.
+        const char* pFirst = std::find_if_not(p, pEnd, isSpace);
+        size_t maxCols = std::count(pFirst, std::find_if(pFirst, pEnd, isEol), ',') + 1;
+        size_t rowBreaks = 0;
+        for (const char* q = pFirst; q < pEnd; ++q)
+        {
+            if (isEol(*q) && (q + 1 == pEnd || !isEol(q[1])))
+                ++rowBreaks;
+        }
+        size_t maxRows = std::min<size_t>(rowBreaks + 1, MaxMapDim);
+        if (maxCols > MaxMapDim + 1) // + 1 for a trailing comma
+        {
+            std::cerr << "Map exceeds " << MaxMapDim << "x" << MaxMapDim << std::endl;
+            return false;
+        }
+        Out.resize(maxCols * maxRows);
+        Uint16* pOut = Out.data();
+        size_t cell = 0;
+
+        while (p < pEnd)
+        {
+            if (isSpace(*p))
+            {
+                ++p;
+                continue;
+            }
+            if (OutH == MaxMapDim)
+            {
+                std::cerr << "Map exceeds " << MaxMapDim << "x" << MaxMapDim << std::endl;
+                return false;
+            }
+
+            int columns = 0;
+            while (true)
+            {
+                while (p < pEnd && isBlank(*p))
+                    ++p;
+                unsigned value = 0;
+                std::from_chars_result result = std::from_chars(p, pEnd, value);
+                const char* pNext = result.ptr;
+                while (pNext < pEnd && isBlank(*pNext))
+                    ++pNext;
+                if (result.ec != std::errc() || value > 0xFFFF || (pNext < pEnd && *pNext != ',' && !isEol(*pNext)))
+                {
+                    const char* pSegEnd = p;
+                    while (pSegEnd < pEnd && *pSegEnd != ',' && !isEol(*pSegEnd))
+                        ++pSegEnd;
+                    std::cerr << "Invalid map value '" << std::string(p, pSegEnd) << "' at row " << OutH + 1 << ", column " << columns + 1 << std::endl;
+                    return false;
+                }
+                if (columns == static_cast<int>(maxCols) || (OutH > 0 && columns == OutW))
+                {
+                    std::cerr << "Map row " << OutH + 1 << " has more than " << (OutH > 0 ? OutW : columns) << " columns" << std::endl;
+                    return false;
+                }
+                if (cell == Out.size())
+                {
+                    std::cerr << "Map row " << OutH + 1 << " runs past the sized map" << std::endl;
+                    return false;
+                }
+                pOut[cell++] = static_cast<Uint16>(value);
+                ++columns;
+
+                p = pNext;
+                if (p == pEnd || *p != ',')
+                    break;
+                ++p;
+                while (p < pEnd && isBlank(*p))
+                    ++p;
+                if (p == pEnd || isEol(*p))
+                    break;
+            }
+
+            if (OutH == 0)
+                OutW = columns;
+            else if (columns != OutW)
+            {
+                std::cerr << "Map row " << OutH + 1 << " has " << columns << " columns, expected " << OutW << std::endl;
+                return false;
+            }
+            ++OutH;
+        }
+
+        if (OutW == 0 || OutH == 0)
+        {
+            Out.clear();
+            std::cerr << "Map file is empty" << std::endl;
+            return false;
+        }
+        Out.resize(static_cast<size_t>(OutW) * OutH);
+        return true;
+    }
+
+    // Reads the whole file into one buffer and parses it; logs parse throughput.
+    static bool ReadCSV(const std::string& filename, std::vector<Uint16>& Out, int& OutW, int& OutH)
+    {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open " << filename << std::endl;
+            return false;
+        }
+        std::string text(static_cast<size_t>(file.tellg()), '\0');
+        file.seekg(0);
+        file.read(&text[0], static_cast<std::streamsize>(text.size()));
+        if (!file)
+        {
+            std::cerr << "Failed to read " << filename << std::endl;
+            return false;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        bool bParsed = ParseCSV(text.data(), text.size(), Out, OutW, OutH);
+        double seconds = static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        if (bParsed)
+        {
+            double megabytes = text.size() / (1024.0 * 1024.0);
+            std::cout << "Parsed " << filename << " (" << OutW << "x" << OutH << ", " << megabytes << " MB) in "
+                << seconds * 1000.0 << " ms, " << (seconds > 0 ? megabytes / seconds : 0.0) << " MB/s" << std::endl;
+        }
+        return bParsed;
+    }
+
+    static Uint32 Checksum(const Uint8* pData, size_t Size)
+    {
+        Uint32 hash = 2166136261u;
+        for (size_t k = 0; k < Size; ++k)
+            hash = (hash ^ pData[k]) * 16777619u;
+        return hash;
+    }
+
+    static bool IsBinaryFile(const std::string& filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        char magic[4] = {};
+        return file.read(magic, 4) && std::memcmp(magic, BinaryMagic, 4) == 0;
+    }
+
+    // Maps the file and validates the header and size; tile data is not touched.
+    static bool OpenBinary(const std::string& filename, MappedFile& file, MapFileHeader& header)
+    {
+        if (!file.Open(filename))
+        {
+            std::cerr << "Failed to map " << filename << std::endl;
+            return false;
+        }
+
+        if (file.GetSize() < sizeof(header))
+        {
+            std::cerr << filename << ": truncated header" << std::endl;
+            return false;
+        }
+        std::memcpy(&header, file.Data(), sizeof(header));
+        // Version 1 files had no ByteOrder field, so they fail the byte order check as well.
+        if (std::memcmp(header.Magic, BinaryMagic, 4) == 0 && header.ByteOrder != ByteOrderMark)
+        {
+            std::cerr << filename << ": saved with a different byte order or an older format version" << std::endl;
+            return false;
+        }
+        if (std::memcmp(header.Magic, BinaryMagic, 4) != 0 || header.Version != BinaryVersion)
+        {
+            std::cerr << filename << ": not a version " << BinaryVersion << " binary map" << std::endl;
+            return false;
+        }
+        if (header.Width == 0 || header.Height == 0 || header.Width > MaxMapDim || header.Height > MaxMapDim || header.Layers == 0)
+        {
+            std::cerr << filename << ": bad dimensions " << header.Width << "x" << header.Height << std::endl;
+            return false;
+        }
+
+        size_t layerBytes = static_cast<size_t>(header.Width) * header.Height * sizeof(Uint16);
+        size_t dataBytes = layerBytes * header.Layers;
+        if (file.GetSize() < sizeof(header) + dataBytes)
+        {
+            std::cerr << filename << ": truncated tile data" << std::endl;
+            return false;
+        }
+        return true;
+    }
 
-        Window::Render(a_RI); // Render window background
+    static const Uint16* GetLayer(const MappedFile& file, const MapFileHeader& header, Uint32 Layer)
+    {
+        size_t layerCells = static_cast<size_t>(header.Width) * header.Height;
+        return reinterpret_cast<const Uint16*>(file.Data() + sizeof(MapFileHeader)) + layerCells * Layer;
+    }
 
-        if (pCastle) {
-            float currentY = Rect.y + 10; // Start with top padding
-            const float lineSpacing = 20; // Adjust as needed
-            const float centerX = Rect.x + Rect.w / 2.0f;
-            const float leftX = Rect.x + 10; // Left padding
+    // Maps the file and copies layer 0 out in one block; no per-tile parsing.
+    static bool ReadBinary(const std::string& filename, std::vector<Uint16>& Out, int& OutW, int& OutH)
+    {
+        Out.clear();
+        OutW = OutH = 0;
 
-            std::string name = pCastle->Name;
-            std::string gold = u8"골드: " + std::to_string(pCastle->Gold);
-            std::string food = u8"식량: " + std::to_string(pCastle->Food);
+        MappedFile file;
+        MapFileHeader header;
+        if (!OpenBinary(filename, file, header))
+            return false;
 
-            a_RI->RenderText(name, leftX, currentY, 0.0f, HAlign::Left);
-            currentY += lineSpacing;
-            a_RI->RenderText(gold, leftX, currentY, 0.0f, HAlign::Left);
-            currentY += lineSpacing;
-            a_RI->RenderText(food, leftX, currentY, 0.0f, HAlign::Left);
+        size_t layerBytes = static_cast<size_t>(header.Width) * header.Height * sizeof(Uint16);
+        const Uint8* pTiles = file.Data() + sizeof(header);
+        if (Checksum(pTiles, layerBytes * header.Layers) != header.Checksum)
+        {
+            std::cerr << filename << ": checksum mismatch" << std::endl;
+            return false;
         }
+
+        Out.resize(static_cast<size_t>(header.Width) * header.Height);
+        std::memcpy(Out.data(), pTiles, layerBytes);
+        OutW = static_cast<int>(header.Width);
+        OutH = static_cast<int>(header.Height);
+        return true;
     }
-};
-// --- End Windowing System ---
 
-class ResourceManager
-{
-    std::vector<Texture*> Data;
-public:
-    enum
+    static bool WriteBinary(const std::string& filename, const std::vector<Uint16>& Data, int W, int H)
     {
-        ResID_SpaceShip = 0,
-        ResID_Alien = 1,
-        ResID_Tile = 2,
-        ResID_Army = 3,
-        ResID_GameMenu = 4,
-        ResID_CastleMenu = 5,
-    };
-    void LoadResources(RenderInterface* RI)
+        MapFileHeader header;
+        std::memcpy(header.Magic, BinaryMagic, 4);
+        header.ByteOrder = ByteOrderMark;
+        header.Version = BinaryVersion;
+        header.Width = static_cast<Uint32>(W);
+        header.Height = static_cast<Uint32>(H);
+        header.Layers = 1;
+        header.Checksum = Checksum(reinterpret_cast<const Uint8*>(Data.data()), Data.size() * sizeof(Uint16));
+
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(Data.data()), static_cast<std::streamsize>(Data.size() * sizeof(Uint16)));
+        if (!file)
+        {
+            std::cerr << "Failed to write " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static bool WriteCSV(const std::string& filename, const std::vector<Uint16>& Data, int W, int H)
     {
-        SDL_Renderer* renderer = static_cast<SDL_Renderer*>(RI->GetRenderer());
-        Data.push_back(new Texture(renderer, "spaceship.bmp", 100, 100));
-        Data.push_back(new Texture(renderer, "alien.bmp", 60, 60));
-        Data.push_back(new Texture(renderer, "buch-outdoor.bmp", 384, 192));
-        Data.push_back(new Texture(renderer, "Army.bmp", 448, 448));
-        Data.push_back(new Texture(renderer, "GameMenu.bmp", 150, 208));
-        Data.push_back(new Texture(renderer, "CastleMenu.bmp", 88, 214));
+        std::ofstream file(filename);
+        for (int j = 0; j < H; ++j) {
+            for (int i = 0; i < W; ++i) {
+                file << Data[static_cast<size_t>(j) * W + i];
+                if (i < W - 1) file << ",";
+            }
+            file << "\n";
+        }
+        if (!file)
+        {
+            std::cerr << "Failed to write " << filename << std::endl;
+            return false;
+        }
+        return true;
     }
-    ~ResourceManager()
+
+    static bool IsBinaryName(const std::string& filename)
+    {
+        const std::string ext = ".hxmap";
+        return filename.size() >= ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+    }
+
+    // Picks the reader from the file's magic, so either format can be loaded by any name.
+    static bool Read(const std::string& filename, std::vector<Uint16>& Out, int& OutW, int& OutH)
     {
-        for (auto& i : Data)
-            delete i;
-        Data.clear();
+        if (IsBinaryFile(filename))
+            return ReadBinary(filename, Out, OutW, OutH);
+
+        return ReadCSV(filename, Out, OutW, OutH);
     }
 
-    Texture& GetTex(int ResID) const
+    // Writes binary for *.hxmap, CSV otherwise.
+    static bool Write(const std::string& filename, const std::vector<Uint16>& Data, int W, int H)
     {
-        return *Data[ResID];
+        return IsBinaryName(filename) ? WriteBinary(filename, Data, W, H) : WriteCSV(filename, Data, W, H);
     }
-};
 
-ResourceManager RM; // Define RM here, after ResourceManager class
+    // Converter between the CSV and binary forms; the output format follows the output name.
+    static int Convert(const std::string& InFile, const std::string& OutFile)
+    {
+        std::vector<Uint16> data;
+        int w = 0, h = 0;
+        if (!Read(InFile, data, w, h) || !Write(OutFile, data, w, h))
+            return 1;
+        std::cout << "Converted " << InFile << " -> " << OutFile << " (" << w << "x" << h << ")" << std::endl;
+        return 0;
+    }
+};
 
-class SDLRenderInterface : public RenderInterface
+// Single-producer single-consumer ring buffer; Push and Pop never lock or block.
+template<typename T, size_t Capacity>
+class SPSCQueue
 {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-
-    TTF_Font* font;
-    SDL_Color textColor = { 255, 255, 255, 255 }; // White color for text
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    T Items[Capacity];
+    alignas(64) std::atomic<size_t> Head{ 0 }; // Next slot to pop, advanced by the consumer
+    alignas(64) std::atomic<size_t> Tail{ 0 }; // Next slot to push, advanced by the producer
 
 public:
-    SDLRenderInterface() : window(nullptr), renderer(nullptr), font(nullptr) {}
+    bool Push(const T& Item)
+    {
+        size_t tail = Tail.load(std::memory_order_relaxed);
+        if (tail - Head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        Items[tail & (Capacity - 1)] = Item;
+        Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
 
-    RenderInterface* CreateRenderer(Viewport* VP) override
+    bool Empty() const { return Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_acquire); }
+
+    bool Pop(T& Out)
     {
-        SDL_Init(SDL_INIT_VIDEO);
+        size_t head = Head.load(std::memory_order_relaxed);
+        if (head == Tail.load(std::memory_order_acquire))
+            return false;
+        Out = Items[head & (Capacity - 1)];
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
 
-        window = SDL_CreateWindow("Hexagon Map Game", VP->WIDTH, VP->HEIGHT, 0);
-        if (!window)
-        {
-            std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << std::endl;
-            SDL_Quit();
-            return nullptr;
-        }
+// Loads map chunks on a worker thread. The main thread pushes chunk ids into Requests and
+// collects decoded chunks from Ready; both queues are lock-free. Binary maps are read straight
+// from the file mapping, so opening one costs a header check however big the map is.
+// CSV maps cannot be read in pieces and are parsed whole when opened. Between requests the
+// worker scans the map for castles a slice of rows at a time and hands them over through
+// PopCastles in row-major order. Once the scan is done an idle worker sleeps on WakeUp until
+// Request pushes a chunk id.
+class MapStreamer
+{
+    static constexpr size_t QueueSize = 1024;
+
+    MappedFile File;
+    std::vector<Uint16> Parsed; // CSV maps only
+    const Uint16* pSource = nullptr;
+    int W = 0;
+    int H = 0;
+    int ChunksX = 0;
+
+    SPSCQueue<int, QueueSize> Requests;
+    SPSCQueue<TileChunk*, QueueSize> Ready;
+    std::thread Worker;
+    std::atomic<bool> bQuit{ false };
+    std::mutex WakeMutex;
+    std::condition_variable WakeUp;
+
+    static constexpr int ScanRowsPerSlice = 64;
+    int ScanRow = 0; // Worker only: first row the castle scan has not reached
+    std::vector<int> ScanFound; // Worker only
+    // Shared with the worker, guarded by FoundMutex.
+    mutable std::mutex FoundMutex;
+    std::vector<int> FoundCastles;
+    bool bScanDone = true;
 
-        renderer = SDL_CreateRenderer(window, nullptr);
-        if (!renderer)
+public:
+    std::string FileName;
+
+    ~MapStreamer() { Close(); }
+
+    // ScanFromRow skips the castle scan over rows whose castles already exist (see StopScan).
+    bool Open(const std::string& filename, int& OutW, int& OutH, int ScanFromRow = 0)
+    {
+        Close();
+        OutW = OutH = 0;
+        if (MapIO::IsBinaryFile(filename))
         {
-            std::cerr << "SDL_CreateRenderer failed: " << SDL_GetError() << std::endl;
-            SDL_DestroyWindow(window);
-            SDL_Quit();
-            return nullptr;
+            MapFileHeader header;
+            if (!MapIO::OpenBinary(filename, File, header))
+                return false;
+            pSource = MapIO::GetLayer(File, header, 0);
+            W = static_cast<int>(header.Width);
+            H = static_cast<int>(header.Height);
         }
-        _VP = VP;
-
-        if (!TTF_Init())
+        else
         {
-            std::cerr << "TTF_Init failed: " << SDL_GetError() << std::endl;
-            SDL_DestroyRenderer(renderer);
-            SDL_DestroyWindow(window);
-            SDL_Quit();
-            return nullptr;
+            if (!MapIO::Read(filename, Parsed, W, H))
+                return false;
+            pSource = Parsed.data();
         }
 
-        font = TTF_OpenFont("NotoSansKR-Medium.ttf", 12);
-        if (!font)
-            std::cerr << "Failed to load font: NotoSansKR-Medium.ttf - " << SDL_GetError() << std::endl;
+        FileName = filename;
+        ChunksX = (W + TileChunk::ChunkMask) >> TileChunk::ChunkShift;
+        ScanRow = std::clamp(ScanFromRow, 0, H);
+        bScanDone = ScanRow == H;
+        bQuit.store(false, std::memory_order_relaxed);
+        Worker = std::thread(&MapStreamer::WorkerMain, this);
+        OutW = W;
+        OutH = H;
+        return true;
+    }
 
-        return this;
+    // Joins the worker and drops every chunk still in flight.
+    void Close()
+    {
+        StopWorker();
+        int chunkId;
+        while (Requests.Pop(chunkId)) {}
+        TileChunk* pChunk;
+        while (Ready.Pop(pChunk))
+            delete pChunk;
+        FoundCastles.clear();
+        bScanDone = true;
+
+        File.Close();
+        Parsed.clear();
+        Parsed.shrink_to_fit();
+        pSource = nullptr;
+        W = H = ChunksX = 0;
+        FileName.clear();
     }
 
-    void Destroy() override
+    bool IsOpen() const { return pSource != nullptr; }
+    const Uint16* GetSource() const { return pSource; }
+
+    bool Request(int chunkId)
     {
-        if (font)
+        if (!Requests.Push(chunkId))
+            return false;
+        // Taking the lock orders the push against a worker that is about to wait.
         {
-            TTF_CloseFont(font);
-            font = nullptr;
+            std::lock_guard<std::mutex> lock(WakeMutex);
         }
-        TTF_Quit();
+        WakeUp.notify_one();
+        return true;
+    }
 
-        if (renderer)
-        {
-            SDL_DestroyRenderer(renderer);
-            renderer = nullptr;
-        }
-        if (window)
-        {
-            SDL_DestroyWindow(window);
-            window = nullptr;
-        }
-        SDL_Quit();
+    // Stops the worker and hands over the castles found but not yet popped. Returns the row the
+    // castle scan stopped at, so a reopen of the same map can carry on from there.
+    int StopScan(std::vector<int>& OutCastles)
+    {
+        StopWorker();
+        PopCastles(OutCastles);
+        return ScanRow;
     }
 
-    void RenderText(const std::string& message, float x, float y, float availableWidth, HAlign align = HAlign::Left) override
+    // Map indices of the castles the scan found since the last call, in row-major order.
+    void PopCastles(std::vector<int>& Out)
     {
-        SDL_FRect textRect;
-        SDL_Texture* textTexture = CreateTextTexture(message, &textRect, x, y);
-        if (!textTexture)
-            return;
+        Out.clear();
+        std::lock_guard<std::mutex> lock(FoundMutex);
+        Out.swap(FoundCastles);
+    }
 
-        float renderX = x;
-        if (align == HAlign::Center) {
-            renderX = x + (availableWidth - textRect.w) / 2.0f;
-        }
-        else if (align == HAlign::Right) {
-            renderX = x + availableWidth - textRect.w;
-        }
-        textRect.x = renderX;
+    // True until the scan has finished and every castle it found was popped.
+    bool HasCastlesToCome() const
+    {
+        std::lock_guard<std::mutex> lock(FoundMutex);
+        return !bScanDone || !FoundCastles.empty();
+    }
+    bool PopReady(TileChunk*& pOut) { return Ready.Pop(pOut); }
 
-        SDL_RenderTexture(renderer, textTexture, nullptr, &textRect); // Changed NULL to nullptr
-        SDL_DestroyTexture(textTexture);
-        if (DM.bShowObjectRect)
+private:
+    void StopWorker()
+    {
+        if (!Worker.joinable())
+            return;
         {
-            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-            SDL_RenderRect(renderer, &textRect);
+            std::lock_guard<std::mutex> lock(WakeMutex);
+            bQuit.store(true, std::memory_order_release);
         }
+        WakeUp.notify_one();
+        Worker.join();
     }
 
-    void RenderObject(Object* Obj, Tile* pTile, bool bSelectedIndex) override
+    void WorkerMain()
     {
-        SDL_FRect srcRect = Obj->GetSrcRect();
-        SDL_RenderTexture(renderer, Obj->pTex->Tex, &srcRect, &pTile->TexDestRect);
-
-        if (bSelectedIndex)
+        while (!bQuit.load(std::memory_order_acquire))
         {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-            SDL_RenderRect(renderer, &pTile->TexDestRect);
+            int chunkId;
+            if (!Requests.Pop(chunkId))
+            {
+                // Requested chunks are on screen, so the castle scan only fills the gaps.
+                if (ScanRow < H)
+                {
+                    ScanCastles();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(WakeMutex);
+                WakeUp.wait(lock, [this] { return bQuit.load(std::memory_order_acquire) || !Requests.Empty(); });
+                continue;
+            }
+
+            TileChunk* pChunk = new TileChunk;
+            Decode(chunkId, *pChunk);
+            while (!Ready.Push(pChunk))
+            {
+                if (bQuit.load(std::memory_order_acquire))
+                {
+                    delete pChunk;
+                    return;
+                }
+                // The main thread has stopped draining Ready; back off until it catches up.
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
         }
-        if (DM.bShowObjectRect)
+    }
+
+    void ScanCastles()
+    {
+        int rowEnd = std::min(ScanRow + ScanRowsPerSlice, H);
+        const size_t end = static_cast<size_t>(rowEnd) * W;
+        ScanFound.clear();
+        for (size_t k = static_cast<size_t>(ScanRow) * W; k < end; ++k)
         {
-            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-            SDL_RenderRect(renderer, &pTile->TexDestRect);
+            if (pSource[k] == TileStore::CastleBitmapIdx)
+                ScanFound.push_back(static_cast<int>(k));
         }
+        ScanRow = rowEnd;
+
+        std::lock_guard<std::mutex> lock(FoundMutex);
+        FoundCastles.insert(FoundCastles.end(), ScanFound.begin(), ScanFound.end());
+        bScanDone = ScanRow == H;
     }
 
-    void RenderTile(Tile* pTile, int X, int Y, int MapW, int MapH, bool bSelectedIndex) override
+    void Decode(int chunkId, TileChunk& Chunk) const
     {
-        SDL_RenderTexture(renderer, RM.GetTex(ResourceManager::ResID_Tile).Tex, &pTile->TexSrcRect, &pTile->TexDestRect);
-
-        if (DM.bShowObjectRect)
-        {
-            //SDL_SetRenderDrawColor(renderer, 0, 255, 255, 200);
+        Chunk.Id = chunkId;
+        int x0 = (chunkId % ChunksX) << TileChunk::ChunkShift;
+        int y0 = (chunkId / ChunksX) << TileChunk::ChunkShift;
+        int w = std::min(TileChunk::ChunkSize, W - x0);
+        int h = std::min(TileChunk::ChunkSize, H - y0);
+
+        std::memset(Chunk.BitmapIdx, 0, sizeof(Chunk.BitmapIdx));
+        for (int y = 0; y < h; ++y)
+            std::memcpy(&Chunk.BitmapIdx[y << TileChunk::ChunkShift], pSource + static_cast<size_t>(y0 + y) * W + x0, w * sizeof(Uint16));
+
+        for (int k = 0; k < TileChunk::CellCount; ++k)
+            Chunk.Bits[k] = Chunk.BitmapIdx[k] == TileStore::CastleBitmapIdx ? TileStore::TileBits_Castle | TileStore::TileBits_NoPlace : 0;
+    }
+};
 
-            //float hex_center_x = pTile->TexDestRect.x + pTile->TexDestRect.w / 2.0f;
-            //float hex_center_y = pTile->TexDestRect.y + pTile->TexDestRect.h / 2.0f;
+// Map cell -> entities standing on it. Several entities may share a cell.
+class EntityCellIndex
+{
+    std::unordered_map<int, std::vector<Entity>> Cells;
+    static const std::vector<Entity> EmptyCell;
 
-            //float s = HEX_SIDE_LENGTH;
-            //float h_half = HEX_SIDE_LENGTH * sqrtf(3.0f) / 2.0f;
+public:
+    void Clear() { Cells.clear(); }
 
-            //SDL_FPoint vertices[6];
-            //vertices[0] = { hex_center_x + s,          hex_center_y };
-            //vertices[1] = { hex_center_x + s * 0.5f,   hex_center_y + h_half };
-            //vertices[2] = { hex_center_x - s * 0.5f,   hex_center_y + h_half };
-            //vertices[3] = { hex_center_x - s,          hex_center_y };
-            //vertices[4] = { hex_center_x - s * 0.5f,   hex_center_y - h_half };
-            //vertices[5] = { hex_center_x + s * 0.5f,   hex_center_y - h_half };
+    void Add(Entity e, int MapIndex)
+    {
+        Cells[MapIndex].push_back(e);
+    }
 
-            //for (int k = 0; k < 6; ++k)
-            //{
-            //    SDL_RenderLine(renderer, vertices[k].x, vertices[k].y,
-            //        vertices[(k + 1) % 6].x, vertices[(k + 1) % 6].y);
-            //}
-        }
-        if (DM.bShowObjectRect)
+    void Remove(Entity e, int MapIndex)
+    {
+        auto it = Cells.find(MapIndex);
+        if (it == Cells.end())
+            return;
+        std::vector<Entity>& bucket = it->second;
+        auto found = std::find(bucket.begin(), bucket.end(), e);
+        if (found != bucket.end())
         {
-            SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-            SDL_RenderRect(renderer, &pTile->TexDestRect);
-            std::string str = std::to_string(X) + "," + std::to_string(Y) + " " + std::to_string(pTile->BitmapIdx);
-            RenderText(str, pTile->TexDestRect.x + pTile->TexDestRect.w / 2.0f, pTile->TexDestRect.y + pTile->TexDestRect.h / 2.0f, 0.0f, HAlign::Center);
+            *found = bucket.back();
+            bucket.pop_back();
         }
+        if (bucket.empty())
+            Cells.erase(it);
+    }
 
-        if (bSelectedIndex)
+    const std::vector<Entity>& At(int mapIdx) const
+    {
+        auto it = Cells.find(mapIdx);
+        return it != Cells.end() ? it->second : EmptyCell;
+    }
+
+    Entity CastleAt(int mapIdx, const EntityWorld& World) const
+    {
+        for (Entity e : At(mapIdx))
+            if (World.Castles.Has(e.Index))
+                return e;
+        return {};
+    }
+
+    // Entities within Radius hex steps of the cell, using cube coordinates of the odd-row offset grid.
+    void InRadius(int mapIdx, int Radius, int MapW, int MapH, std::vector<Entity>& Out) const
+    {
+        Out.clear();
+        if (MapW <= 0)
+            return;
+        int col = mapIdx % MapW;
+        int row = mapIdx / MapW;
+        int q = col - (row - (row & 1)) / 2;
+
+        for (int dr = -Radius; dr <= Radius; ++dr)
         {
-            SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-            SDL_RenderRect(renderer, &pTile->TexDestRect);
+            int r = row + dr;
+            if (r < 0 || r >= MapH)
+                continue;
+            int dqMin = std::max(-Radius, -dr - Radius);
+            int dqMax = std::min(Radius, -dr + Radius);
+            for (int dq = dqMin; dq <= dqMax; ++dq)
+            {
+                int c = q + dq + (r - (r & 1)) / 2;
+                if (c < 0 || c >= MapW)
+                    continue;
+                const std::vector<Entity>& bucket = At(r * MapW + c);
+                Out.insert(Out.end(), bucket.begin(), bucket.end());
+            }
         }
     }
+};
+const std::vector<Entity> EntityCellIndex::EmptyCell;
 
-    void RenderTexture(Texture* pTex, SDL_FRect* pDestRect) override
+class Level : public SubSystem, public InputHandler
+{
+    EntityWorld World;
+    EntityCellIndex EntityIndex;
+    std::vector<Entity> PendingDestroy; // Sprites with bShow == false, released in one batch per Update
+
+    Entity spaceship;
+
+    // Dimensions come from the map file: columns of the first row and number of rows.
+    int MapW = 0;
+    int MapH = 0;
+
+    TileStore Tiles;
+    MapStreamer Streamer;
+    std::vector<int> NewCastles; // Scratch for castles handed over by the streamer
+    int NextCastleFaction = Faction_Wee;
+
+    // Chunk streaming: resident chunks are capped by ChunkMemoryBudget, and the request area
+    // reaches as far as the camera travels in PrefetchFrames at its smoothed velocity.
+    static constexpr size_t ChunkMemoryBudget = 64 * 1024 * 1024;
+    static constexpr float PrefetchFrames = 30.0f;
+    Uint64 StreamFrame = 0;
+    float PrevCamX = 0, PrevCamY = 0;
+    float CamVelX = 0, CamVelY = 0;
+
+    // Terrain is cached in one render target per TerrainBlockSize x TerrainBlockSize tiles, and a
+    // frame only composites the visible blocks. A block is redrawn (as one mesh) only when dirty:
+    // an edited tile, a chunk streamed in, a new map, a moved tile texture or lost render targets.
+    // Blocks that were not drawn recently are released once the cache exceeds its budget.
+    struct TerrainBlock
     {
-        SDL_FRect srcRect = { 0,0, static_cast<float>(pTex->W), static_cast<float>(pTex->H) };
-        SDL_RenderTexture(renderer, pTex->Tex, &srcRect, pDestRect);
-    }
+        Texture Target{ nullptr, 0, 0 };
+        bool bDirty = true;
+        Uint64 LastUsedFrame = 0;
+    };
+    static constexpr int TerrainBlockShift = 4;
+    static constexpr int TerrainBlockSize = 1 << TerrainBlockShift;
+    static constexpr size_t TerrainCacheBudget = 64 * 1024 * 1024;
+    std::unordered_map<int, TerrainBlock> TerrainBlocks; // Keyed by blockRow * TerrainBlocksX + blockCol
+    int TerrainBlocksX = 0;
+    size_t TerrainCacheBytes = 0;
+    Uint64 RenderFrame = 0;
+    Uint32 TerrainTexVersion = 0; // Tile texture's atlas placement the blocks were drawn with
+    std::vector<SDL_Vertex> BlockVertices;
+    std::vector<int> TileIndices;
+    RenderInterface* pRI = nullptr; // Owns the terrain render targets
+
+    // Cam moves in fixed view ticks; PrevTickCam is where it was one tick earlier and ViewCam is
+    // the interpolated camera the current frame is drawn (and picked) with.
+    Camera Cam;
+    Camera PrevTickCam;
+    Camera ViewCam;
+    float ViewAlpha = 1.0f;
+    bool bDragging = false;
+    static constexpr float CameraPanSpeed = 8.0f; // Per view tick
+
+    static constexpr int TicksPerMonth = 30; // Simulation ticks per castle economy month
+    int EconomyTicks = 0;
 
-    void RenderBox(SDL_FRect* pFRect, Uint8 R, Uint8 G, Uint8 B, Uint8 A) override
+public:
+    int Width = 0;
+    int Height = 0;
+
+    int SelectedIndex = -1;
+    int HoveredIndex = -1;
+
+    void Init(const Viewport& VP, RenderInterface* a_pRI)
     {
-        SDL_SetRenderDrawColor(renderer, R, G, B, A);
-        SDL_RenderRect(renderer, pFRect);
+        Width = VP.WIDTH;
+        Height = VP.HEIGHT;
+        pRI = a_pRI;
+
+        initMap();
     }
 
-    void PreRender() override
+    void UpdateCameraBounds()
     {
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
+        float worldW = MapW * HORIZONTAL_SPACING + ODD_ROW_X_OFFSET;
+        float worldH = MapH * VERTICAL_SPACING;
+        Cam.SetBounds(static_cast<float>(Width), static_cast<float>(Height), worldW, worldH);
+        PrevTickCam = ViewCam = Cam;
     }
 
-    void PostRender() override
+    // Inclusive tile range overlapping the screen; empty when MinCol > MaxCol.
+    void GetVisibleRange(const Camera& C, int& MinCol, int& MaxCol, int& MinRow, int& MaxRow) const
     {
-        SDL_RenderPresent(renderer);
+        MinRow = std::max(0, static_cast<int>(std::floor(C.Y / VERTICAL_SPACING)));
+        MaxRow = std::min(MapH - 1, static_cast<int>(std::floor((C.Y + C.ViewH) / VERTICAL_SPACING)));
+        // Odd rows are shifted right, so the left edge may still show an odd-row tile one column earlier.
+        MinCol = std::max(0, static_cast<int>(std::floor((C.X - ODD_ROW_X_OFFSET) / HORIZONTAL_SPACING)));
+        MaxCol = std::min(MapW - 1, static_cast<int>(std::floor((C.X + C.ViewW) / HORIZONTAL_SPACING)));
     }
 
-    void* GetRenderer() { return renderer; }
-    void SetWindowTitle(const std::string& title) override { SDL_SetWindowTitle(window, title.c_str()); }
+    bool IsTileVisible(int mapIdx) const
+    {
+        int minCol, maxCol, minRow, maxRow;
+        GetVisibleRange(ViewCam, minCol, maxCol, minRow, maxRow);
+        if (MapW <= 0)
+            return false;
+        int i = mapIdx % MapW;
+        int j = mapIdx / MapW;
+        return minCol <= i && i <= maxCol && minRow <= j && j <= maxRow;
+    }
 
-    SDL_Texture* CreateTextTexture(const std::string& message, SDL_FRect* outRect, float x, float y)
+    void initMap()
     {
-        if (!font) {
-            std::cerr << "Cannot create text texture: Font not loaded." << std::endl;
-            return nullptr;
+        const char* candidates[] = { "savemap.hxmap", "savemap.txt", "map.txt" };
+        for (const char* filename : candidates)
+        {
+            if (std::ifstream(filename).is_open())
+            {
+                OpenMap(filename);
+                return;
+            }
         }
+        std::cerr << "Failed to open map file" << std::endl;
+        // Handle error, maybe load a default map or exit
+        Streamer.Close();
+        BuildTiles(false);
+    }
 
-        SDL_Surface* textSurface = TTF_RenderText_Solid(font, message.c_str(), strlen(message.c_str()), textColor);
-        if (!textSurface) {
-            std::cerr << "Failed to create text surface: " << SDL_GetError() << std::endl;
-            return nullptr;
-        }
-        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-        if (!textTexture) {
-            std::cerr << "Failed to create text texture: " << SDL_GetError() << std::endl;
-            SDL_DestroySurface(textSurface);
-            return nullptr;
-        }
+    void OpenMap(const std::string& filename)
+    {
+        Streamer.Close();
+        BuildTiles(Streamer.Open(filename, MapW, MapH));
+    }
 
-        *outRect = { x, y, static_cast<float>(textSurface->w), static_cast<float>(textSurface->h) };
+    // Sets up the empty chunk table and the camera once the streamer knows the map size.
+    // Tiles arrive later, chunk by chunk, and castles as the streamer's scan finds them, both
+    // through UpdateStreaming.
+    void BuildTiles(bool bParsed)
+    {
+        if (!bParsed)
+            MapW = MapH = 0;
+        Tiles.Reset(MapW, MapH);
+
+        Texture& mapTex = RM.GetTex(ResourceManager::ResID_Tile);
+        Tiles.BuildSrcRects(mapTex.W, mapTex.H);
+        NextCastleFaction = Faction_Wee;
 
-        SDL_DestroySurface(textSurface);
-        return textTexture;
+        ReleaseTerrainBlocks();
+        TerrainBlocksX = (MapW + TerrainBlockSize - 1) >> TerrainBlockShift;
+        UpdateCameraBounds();
+        SelectedIndex = -1;
+        HoveredIndex = -1;
+        PrevCamX = Cam.X;
+        PrevCamY = Cam.Y;
+        CamVelX = CamVelY = 0;
+        UpdateStreaming();
     }
-};
 
-class SubSystem
-{
-public:
-    virtual void Update() = 0;
-    virtual void Render(RenderInterface* RI) = 0; // Forward declare RenderInterface
-};
+    // Installs finished chunks, requests the ones around the camera and evicts down to the budget.
+    void UpdateStreaming()
+    {
+        if (!Streamer.IsOpen())
+            return;
+        ++StreamFrame;
+
+        CamVelX = CamVelX * 0.8f + (Cam.X - PrevCamX) * 0.2f;
+        CamVelY = CamVelY * 0.8f + (Cam.Y - PrevCamY) * 0.2f;
+        PrevCamX = Cam.X;
+        PrevCamY = Cam.Y;
+
+        TileChunk* pChunk;
+        while (Streamer.PopReady(pChunk))
+            InstallChunk(pChunk);
+
+        // Castles are simulated whether or not their chunk was ever streamed in, so they come
+        // from the streamer's scan of the whole map. It reports them in row-major order, which
+        // fixes their factions.
+        Streamer.PopCastles(NewCastles);
+        CreateNewCastles();
+
+        int minCol, maxCol, minRow, maxRow;
+        GetVisibleRange(Cam, minCol, maxCol, minRow, maxRow);
+        if (minCol > maxCol || minRow > maxRow)
+            return;
 
-class InputHandler
-{
-public:
-    virtual bool HandleInput(const SDL_Event& event) = 0;
-};
+        // Visible chunks first, then a one-chunk ring stretched in the direction of travel.
+        const int shift = TileChunk::ChunkShift;
+        RequestChunks(minCol >> shift, maxCol >> shift, minRow >> shift, maxRow >> shift);
 
-class Level : public SubSystem, public InputHandler
-{
-    Object* spaceship;
-    std::vector<Object*> objects;
+        int aheadCols = static_cast<int>(CamVelX * PrefetchFrames / HORIZONTAL_SPACING);
+        int aheadRows = static_cast<int>(CamVelY * PrefetchFrames / VERTICAL_SPACING);
+        RequestChunks(((minCol + std::min(0, aheadCols)) >> shift) - 1, ((maxCol + std::max(0, aheadCols)) >> shift) + 1,
+                      ((minRow + std::min(0, aheadRows)) >> shift) - 1, ((maxRow + std::max(0, aheadRows)) >> shift) + 1);
 
-    static const int MapW = 20;
-    static const int MapH = 20;
-    std::vector<int> pMap; // Changed to dynamic array
+        EvictChunks();
+    }
 
-    std::vector<Tile*> vTileMap;
+    void CreateNewCastles()
+    {
+        for (int mapIdx : NewCastles)
+            createCastle(mapIdx, static_cast<Faction>(NextCastleFaction++));
+        if (!NewCastles.empty())
+            Redraw.Invalidate();
+    }
 
-public:
-    int Width = 0;
-    int Height = 0;
+    void RequestChunks(int MinX, int MaxX, int MinY, int MaxY)
+    {
+        MinX = std::max(MinX, 0);
+        MinY = std::max(MinY, 0);
+        MaxX = std::min(MaxX, Tiles.ChunksX - 1);
+        MaxY = std::min(MaxY, Tiles.ChunksY - 1);
+        for (int cy = MinY; cy <= MaxY; ++cy)
+        {
+            for (int cx = MinX; cx <= MaxX; ++cx)
+            {
+                int id = cy * Tiles.ChunksX + cx;
+                if (Tiles.Chunks[id])
+                    Tiles.Chunks[id]->LastUsedFrame = StreamFrame;
+                else if (Tiles.States[id] == TileStore::Chunk_Absent && Streamer.Request(id))
+                {
+                    Tiles.States[id] = TileStore::Chunk_Requested;
+                    ++Tiles.RequestedCount;
+                }
+            }
+        }
+    }
 
-    int SelectedIndex = -1;
+    void InstallChunk(TileChunk* pChunk)
+    {
+        int id = pChunk->Id;
+        if (Tiles.States[id] != TileStore::Chunk_Requested)
+        {
+            delete pChunk;
+            return;
+        }
+        --Tiles.RequestedCount;
+        pChunk->LastUsedFrame = StreamFrame;
+        Tiles.Install(pChunk);
+        Redraw.Invalidate();
+
+        int x0 = (id % Tiles.ChunksX) << TileChunk::ChunkShift;
+        int y0 = (id / Tiles.ChunksX) << TileChunk::ChunkShift;
+        // Blocks drawn before the chunk arrived are missing its tiles.
+        InvalidateTerrain(x0, y0, x0 + TileChunk::ChunkSize - 1, y0 + TileChunk::ChunkSize - 1);
+    }
 
-    void Init(const Viewport& VP)
+    // Least recently requested chunks go first; chunks needed this frame and edited chunks stay.
+    void EvictChunks()
     {
-        Width = VP.WIDTH;
-        Height = VP.HEIGHT;
+        const int maxResident = static_cast<int>(ChunkMemoryBudget / sizeof(TileChunk));
+        if (Tiles.ResidentCount <= maxResident)
+            return;
 
-        initMap();
+        std::vector<std::pair<Uint64, int>> candidates;
+        for (const std::unique_ptr<TileChunk>& pChunk : Tiles.Chunks)
+        {
+            if (pChunk && !pChunk->bDirty && pChunk->LastUsedFrame != StreamFrame)
+                candidates.emplace_back(pChunk->LastUsedFrame, pChunk->Id);
+        }
+        size_t evictCount = std::min(candidates.size(), static_cast<size_t>(Tiles.ResidentCount - maxResident));
+        std::partial_sort(candidates.begin(), candidates.begin() + evictCount, candidates.end());
+        for (size_t k = 0; k < evictCount; ++k)
+            Tiles.Evict(candidates[k].second);
     }
 
-    void initMap()
+    // Quad for tile (i, j) with positions relative to the world point (OriginX, OriginY).
+    void WriteTileQuad(SDL_Vertex* pVtx, int mapIdx, int i, int j, float OriginX, float OriginY) const
     {
-        pMap.clear(); // Clear existing map data
-        std::ifstream mapFile("savemap.txt");
-        if (!mapFile.is_open())
-            mapFile.open("map.txt");
-        if (!mapFile.is_open())
+        if (!Tiles.IsResident(mapIdx))
         {
-            std::cerr << "Failed to open map file" << std::endl;
-            // Handle error, maybe load a default map or exit
+            // Not streamed in yet: a zero-area quad keeps the mesh layout without drawing anything.
+            std::fill(pVtx, pVtx + 4, SDL_Vertex{});
             return;
         }
 
-        std::string line;
-        while (std::getline(mapFile, line))
+        Texture& mapTex = RM.GetTex(ResourceManager::ResID_Tile);
+        SDL_FRect src = mapTex.PageRect(Tiles.GetSrcRect(mapIdx));
+        SDL_FRect dst = TileStore::GetDestRect(i, j);
+        dst.x -= OriginX;
+        dst.y -= OriginY;
+
+        float u0 = src.x / mapTex.PageW;
+        float v0 = src.y / mapTex.PageH;
+        float u1 = (src.x + src.w) / mapTex.PageW;
+        float v1 = (src.y + src.h) / mapTex.PageH;
+        const SDL_FColor white = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+        pVtx[0] = { { dst.x,         dst.y         }, white, { u0, v0 } };
+        pVtx[1] = { { dst.x + dst.w, dst.y         }, white, { u1, v0 } };
+        pVtx[2] = { { dst.x + dst.w, dst.y + dst.h }, white, { u1, v1 } };
+        pVtx[3] = { { dst.x,         dst.y + dst.h }, white, { u0, v1 } };
+    }
+
+    // World rect a block's target covers; odd rows reach half a tile past its last column.
+    static SDL_FRect GetTerrainBlockRect(int BlockX, int BlockY)
+    {
+        return { BlockX * TerrainBlockSize * HORIZONTAL_SPACING, BlockY * TerrainBlockSize * VERTICAL_SPACING,
+                 TerrainBlockSize * HORIZONTAL_SPACING + ODD_ROW_X_OFFSET, TerrainBlockSize * VERTICAL_SPACING };
+    }
+
+    // Marks the blocks overlapping the inclusive tile range for redrawing.
+    void InvalidateTerrain(int MinCol, int MinRow, int MaxCol, int MaxRow)
+    {
+        MaxCol = std::min(MaxCol, MapW - 1);
+        MaxRow = std::min(MaxRow, MapH - 1);
+        for (int by = MinRow >> TerrainBlockShift; by <= MaxRow >> TerrainBlockShift; ++by)
         {
-            std::stringstream ss(line);
-            std::string segment;
-            while (std::getline(ss, segment, ','))
+            for (int bx = MinCol >> TerrainBlockShift; bx <= MaxCol >> TerrainBlockShift; ++bx)
             {
-                pMap.push_back(std::stoi(segment));
+                auto it = TerrainBlocks.find(by * TerrainBlocksX + bx);
+                if (it != TerrainBlocks.end())
+                    it->second.bDirty = true;
             }
         }
-        mapFile.close();
+    }
 
-        Texture& mapTex = RM.GetTex(ResourceManager::ResID_Tile);
+    void InvalidateAllTerrain()
+    {
+        for (auto& entry : TerrainBlocks)
+            entry.second.bDirty = true;
+    }
+
+    void ReleaseTerrainBlocks()
+    {
+        for (auto& entry : TerrainBlocks)
+            pRI->DestroyRenderTarget(entry.second.Target);
+        TerrainBlocks.clear();
+        TerrainCacheBytes = 0;
+    }
+
+    // Returns the block's target, drawing its tiles into it first when it is new or dirty.
+    TerrainBlock* GetTerrainBlock(int BlockX, int BlockY)
+    {
+        TerrainBlock& block = TerrainBlocks[BlockY * TerrainBlocksX + BlockX];
+        block.LastUsedFrame = RenderFrame;
+        if (!block.Target.bReady)
+        {
+            SDL_FRect rect = GetTerrainBlockRect(BlockX, BlockY);
+            if (!pRI->CreateRenderTarget(block.Target, static_cast<int>(rect.w), static_cast<int>(rect.h)))
+                return nullptr;
+            TerrainCacheBytes += static_cast<size_t>(rect.w) * static_cast<size_t>(rect.h) * 4;
+            block.bDirty = true;
+        }
+        if (block.bDirty)
+            DrawTerrainBlock(block, BlockX, BlockY);
+        return &block;
+    }
 
-        for (int j = 0; j < MapH; ++j)
+    void DrawTerrainBlock(TerrainBlock& Block, int BlockX, int BlockY)
+    {
+        ProfileScope zone("Level::DrawTerrainBlock");
+        int minCol = BlockX << TerrainBlockShift, maxCol = std::min(MapW, minCol + TerrainBlockSize) - 1;
+        int minRow = BlockY << TerrainBlockShift, maxRow = std::min(MapH, minRow + TerrainBlockSize) - 1;
+        int rowTiles = maxCol - minCol + 1;
+        size_t quadCount = static_cast<size_t>(rowTiles) * (maxRow - minRow + 1);
+        BlockVertices.resize(quadCount * 4);
+
+        // Quads are sequential, so the index pattern only grows and never changes.
+        for (size_t q = TileIndices.size() / 6; q < quadCount; ++q)
         {
-            for (int i = 0; i < MapW; ++i)
-            {
-                int mapIdx = j * MapW + i;
-                int bitmapIdx = pMap[mapIdx];
-                Tile* pTile = nullptr;
+            int base = static_cast<int>(q * 4);
+            TileIndices.insert(TileIndices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+        }
 
-                if (bitmapIdx == 202)
-                {
-                    pTile = new CastleTile();
-                    static int createdFaction = Faction_Wee;
-                    createCastle(mapIdx, static_cast<Faction>(createdFaction++));
-                    std::cout << "Created castle at map index: " << mapIdx << std::endl;
-                }
-                else
-                    pTile = new Tile();
-                pTile->BitmapIdx = bitmapIdx;
-                pTile->MapIdx = mapIdx;
-
-                int mapTexW = static_cast<int>(mapTex.W);
-                int mapTileTexW = mapTexW / Tile::SourceBitmapTileSize;
-                float srcX = static_cast<float>((pTile->BitmapIdx % mapTileTexW) * Tile::SourceBitmapTileSize);
-                float srcY = static_cast<float>((pTile->BitmapIdx / mapTileTexW) * Tile::SourceBitmapTileSize);
-                pTile->TexSrcRect = { srcX, srcY, static_cast<float>(Tile::SourceBitmapTileSize), static_cast<float>(Tile::SourceBitmapTileSize) };
-
-                float destX = i * HORIZONTAL_SPACING;
-                float destY = j * VERTICAL_SPACING;
-
-                if (j % 2 != 0) {
-                    destX += ODD_ROW_X_OFFSET;
-                }
+        SDL_FRect origin = GetTerrainBlockRect(BlockX, BlockY);
+        SDL_Vertex* pOut = BlockVertices.data();
+        for (int j = minRow; j <= maxRow; ++j)
+            for (int i = minCol; i <= maxCol; ++i, pOut += 4)
+                WriteTileQuad(pOut, j * MapW + i, i, j, origin.x, origin.y);
 
-                pTile->TexDestRect = { destX, destY, HEX_FLAT_TOP_WIDTH, HEX_FLAT_TOP_HEIGHT };
+        pRI->BeginRenderTarget(Block.Target);
+        pRI->RenderGeometry(&RM.GetTex(ResourceManager::ResID_Tile), BlockVertices.data(), static_cast<int>(quadCount * 4), TileIndices.data(), static_cast<int>(quadCount * 6));
+        pRI->EndRenderTarget();
+        Block.bDirty = false;
+    }
 
-                vTileMap.push_back(pTile);
-            }
+    // Least recently drawn blocks go first; blocks on screen this frame stay.
+    void EvictTerrainBlocks()
+    {
+        if (TerrainCacheBytes <= TerrainCacheBudget)
+            return;
+        std::vector<std::pair<Uint64, int>> candidates;
+        for (const auto& entry : TerrainBlocks)
+            if (entry.second.LastUsedFrame != RenderFrame)
+                candidates.push_back({ entry.second.LastUsedFrame, entry.first });
+        std::sort(candidates.begin(), candidates.end());
+
+        for (const auto& candidate : candidates)
+        {
+            if (TerrainCacheBytes <= TerrainCacheBudget)
+                break;
+            TerrainBlock& block = TerrainBlocks[candidate.second];
+            TerrainCacheBytes -= static_cast<size_t>(block.Target.W) * static_cast<size_t>(block.Target.H) * 4;
+            pRI->DestroyRenderTarget(block.Target);
+            TerrainBlocks.erase(candidate.second);
         }
     }
 
-    void CreateSpaceShip(Texture& Tex)
+    Entity CreateUnit(UnitType Type, Faction Fac, int MapIndex)
+    {
+        Entity e = World.Create();
+        World.Cells.Add(e.Index, { MapIndex });
+        World.Factions.Add(e.Index, { Fac });
+        SpriteComponent sprite;
+        sprite.Tex = RM.Acquire(ResourceManager::ResID_Army);
+        sprite.SrcRect = { 32.0f * Type, 192 + 32 * static_cast<float>(Fac), 32, 32 };
+        World.Sprites.Add(e.Index, sprite);
+        EntityIndex.Add(e, MapIndex);
+        return e;
+    }
+
+    void DestroyAllObjects()
     {
-        spaceship = new Object();
-        objects.push_back(spaceship);
+        World.Clear();
+        EntityIndex.Clear();
+        PendingDestroy.clear();
+    }
+
+    void CreateSpaceShip()
+    {
+        spaceship = World.Create();
+        World.Cells.Add(spaceship.Index, { 0 });
+        EntityIndex.Add(spaceship, 0);
     }
 
     void createCastle(int MapIndex, Faction a_Fac)
     {
-        Castle* castle = new Castle(a_Fac);
-        castle->Init(RM.GetTex(ResourceManager::ResID_Army), MapIndex);
+        Entity e = CreateUnit(Unit_Castle, a_Fac, MapIndex);
+        CastleComponent castle;
+        CastleStats stats;
 
         switch (MapIndex)
         {
         case 94:
-            castle->InitData(u8"허창", 2200, 22000);
+            castle.Name = u8"허창"; stats.Gold = 2200; stats.Food = 22000;
             break;
         case 241:
-            castle->InitData(u8"성도", 4400, 47400);
+            castle.Name = u8"성도"; stats.Gold = 4400; stats.Food = 47400;
             break;
         case 315:
-            castle->InitData(u8"낙양", 5000, 454000);
+            castle.Name = u8"낙양"; stats.Gold = 5000; stats.Food = 454000;
             break;
         default:
-            castle->InitData(u8"디폴트", 1000, 10000);
+            castle.Name = u8"디폴트"; stats.Gold = 1000; stats.Food = 10000;
             break;
         }
-        objects.push_back(castle);
+        World.Castles.Add(e.Index, std::move(castle));
+        World.Economy.Add(e.Index, stats);
     }
 
     void createSpearman(int MapIndex, Faction Fac)
     {
-        Spearman* spearman = new Spearman(Fac);
-        spearman->Init(RM.GetTex(ResourceManager::ResID_Army), MapIndex);
-        objects.push_back(spearman);
+        CreateUnit(Unit_Spearman, Fac, MapIndex);
+    }
+
+    void MoveEntity(Entity e, int NewMapIndex)
+    {
+        CellComponent* pCell = World.IsAlive(e) ? World.Cells.Get(e.Index) : nullptr;
+        if (!pCell || !Tiles.IsValid(NewMapIndex))
+            return;
+        EntityIndex.Remove(e, pCell->MapIndex);
+        pCell->MapIndex = NewMapIndex;
+        EntityIndex.Add(e, NewMapIndex);
+    }
+
+    // Hides e; the lifecycle pass of the next Update destroys it.
+    void RemoveEntity(Entity e)
+    {
+        if (SpriteComponent* pSprite = World.IsAlive(e) ? World.Sprites.Get(e.Index) : nullptr)
+            pSprite->bShow = false;
     }
 
+    const std::vector<Entity>& GetEntitiesAt(int mapIdx) const { return EntityIndex.At(mapIdx); }
+    Entity GetCastleAt(int mapIdx) const { return EntityIndex.CastleAt(mapIdx, World); }
+    void GetEntitiesInRadius(int mapIdx, int Radius, std::vector<Entity>& Out) const { EntityIndex.InRadius(mapIdx, Radius, MapW, MapH, Out); }
+
     bool SetCastleInfoWnd(class Window* pWnd) // Forward declare Window
     {
-        CastleInfoWnd* pCastleInfoWnd = static_cast<CastleInfoWnd*>(pWnd);
-        for (Object* obj : objects)
-        {
-            if (obj->MapIndex == SelectedIndex && dynamic_cast<Castle*>(obj))
-            {
-                Castle* pCastle = static_cast<Castle*>(obj);
-                static_cast<CastleInfoWnd*>(pWnd)->Init(pCastle);
-                return true;
-            }
-        }
-        return false;
+        Entity castle = GetCastleAt(SelectedIndex);
+        if (!World.IsAlive(castle))
+            return false;
+        static_cast<CastleInfoWnd*>(pWnd)->Init(&World, castle);
+        return true;
     }
 
     void Destroy()
     {
-        for (Object* obj : objects)
-            delete obj;
-        objects.clear();
-
-        for (auto& i : vTileMap)
-            delete i;
-        vTileMap.clear();
+        DestroyAllObjects();
+
+        Streamer.Close();
+        Tiles.Clear();
+        MapW = MapH = 0;
+        ReleaseTerrainBlocks();
+        BlockVertices.clear();
+        TileIndices.clear();
     }
 
-    size_t GetObjNum() const { return objects.size(); }
+    size_t GetObjNum() const { return World.Size(); }
 
     void SaveMap(const std::string& filename) {
-        std::ofstream file(filename);
-        for (int j = 0; j < MapH; ++j) {
-            for (int i = 0; i < MapW; ++i) {
-                file << vTileMap[j * MapW + i]->BitmapIdx;
-                if (i < MapW - 1) file << ",";
-            }
-            file << "\n";
-        }
-        file.close();
-    }
-
-    void LoadMap(const std::string& filename) {
-        for (auto& obj : objects) delete obj;
-        objects.clear();
-        for (auto& t : vTileMap) delete t;
-        vTileMap.clear();
-        pMap.clear();
-
-        std::ifstream mapFile(filename);
-        if (!mapFile.is_open()) {
-            std::cerr << "Failed to open " << filename << std::endl;
+        if (Tiles.Size() == 0 || !Streamer.IsOpen()) {
+            std::cerr << "No map loaded, not saving " << filename << std::endl;
             return;
         }
-
-        std::string line;
-        while (std::getline(mapFile, line)) {
-            std::stringstream ss(line);
-            std::string segment;
-            while (std::getline(ss, segment, ',')) {
-                pMap.push_back(std::stoi(segment));
-            }
+        std::vector<Uint16> data;
+        Tiles.Gather(Streamer.GetSource(), data);
+
+        // The target may be the file the streamer has mapped, so release it before writing
+        // and stream from the saved file afterwards. Resident chunks already match it, and the
+        // castle scan carries on where it stopped.
+        std::string source = Streamer.FileName;
+        int scanRow = Streamer.StopScan(NewCastles);
+        CreateNewCastles();
+        Streamer.Close();
+        Tiles.ForgetRequests();
+        bool bSaved = MapIO::Write(filename, data, MapW, MapH);
+        int w, h;
+        if (!Streamer.Open(bSaved ? filename : source, w, h, scanRow))
+            std::cerr << "Failed to reopen map after saving " << filename << std::endl;
+        if (bSaved)
+        {
+            for (std::unique_ptr<TileChunk>& pChunk : Tiles.Chunks)
+                if (pChunk)
+                    pChunk->bDirty = false;
         }
-        mapFile.close();
-
-        Texture& mapTex = RM.GetTex(ResourceManager::ResID_Tile);
-
-        for (int j = 0; j < MapH; ++j) {
-            for (int i = 0; i < MapW; ++i) {
-                int mapIdx = j * MapW + i;
-                int bitmapIdx = pMap[mapIdx];
-                Tile* pTile = nullptr;
+    }
 
-                if (bitmapIdx == 202) {
-                    pTile = new CastleTile();
-                    static int createdFaction = Faction_Wee;
-                    createCastle(mapIdx, static_cast<Faction>(createdFaction++));
-                }
-                else
-                    pTile = new Tile();
-                pTile->BitmapIdx = bitmapIdx;
-                pTile->MapIdx = mapIdx;
-
-                int mapTexW = static_cast<int>(mapTex.W);
-                int mapTileTexW = mapTexW / Tile::SourceBitmapTileSize;
-                float srcX = static_cast<float>((pTile->BitmapIdx % mapTileTexW) * Tile::SourceBitmapTileSize);
-                float srcY = static_cast<float>((pTile->BitmapIdx / mapTileTexW) * Tile::SourceBitmapTileSize);
-                pTile->TexSrcRect = { srcX, srcY, static_cast<float>(Tile::SourceBitmapTileSize), static_cast<float>(Tile::SourceBitmapTileSize) };
-
-                float destX = i * HORIZONTAL_SPACING;
-                float destY = j * VERTICAL_SPACING;
-
-                if (j % 2 != 0) {
-                    destX += ODD_ROW_X_OFFSET;
-                }
+    // Only opens the file; tiles and castles stream in over the next frames instead of blocking here.
+    void LoadMap(const std::string& filename) {
+        DestroyAllObjects();
+        OpenMap(filename);
+    }
 
-                pTile->TexDestRect = { destX, destY, HEX_FLAT_TOP_WIDTH, HEX_FLAT_TOP_HEIGHT };
+    // Closed-form pick in world coordinates. Tile boxes tile each row without overlap, so the
+    // containing box is found by division and only its hex needs the exact test. A point on the
+    // shared edge of two boxes goes to the lower index, matching a linear scan over the map.
+    // Row edges never need a second test because they lie outside both hexes.
+    int PickTile(float wx, float wy) const
+    {
+        int j = static_cast<int>(std::floor(wy / VERTICAL_SPACING));
+        if (j < 0 || j >= MapH)
+            return -1;
+
+        float col = (wx - ((j & 1) ? ODD_ROW_X_OFFSET : 0.0f)) / HORIZONTAL_SPACING;
+        int i = static_cast<int>(std::floor(col));
+        if (col == static_cast<float>(i) && i > 0 && i <= MapW &&
+            Tile::IsInHex(TileStore::GetDestRect(i - 1, j), wx, wy, HEX_SIDE_LENGTH))
+            return j * MapW + i - 1;
+        if (i < 0 || i >= MapW)
+            return -1;
+        return Tile::IsInHex(TileStore::GetDestRect(i, j), wx, wy, HEX_SIDE_LENGTH) ? j * MapW + i : -1;
+    }
 
-                vTileMap.push_back(pTile);
-            }
-        }
-        SelectedIndex = -1;
+    // x, y are screen coordinates, resolved against the camera the last frame was drawn with.
+    int GetTileAtPosition(float x, float y) const
+    {
+        float wx, wy;
+        ViewCam.ScreenToWorld(x, y, wx, wy);
+        return PickTile(wx, wy);
     }
 
-    int GetTileAtPosition(float x, float y)
+    // Batch variant for many screen points, e.g. the samples of an editor drag stroke.
+    void GetTilesAtPositions(const SDL_FPoint* pPoints, int Count, int* pOutIdx) const
     {
-        for (auto& pTile : vTileMap)
-        {
-            if (pTile->IsInHex(x, y, HEX_SIDE_LENGTH))
-                return pTile->MapIdx;
-        }
-        return -1;
+        for (int k = 0; k < Count; ++k)
+            pOutIdx[k] = PickTile(pPoints[k].x + ViewCam.X, pPoints[k].y + ViewCam.Y);
     }
 
     void SetTileBitmapIdx(int mapIdx, int bitmapIdx)
     {
-        if (mapIdx < 0 || mapIdx >= MapW * MapH) return;
-        Tile* pTile = vTileMap[mapIdx];
-        pTile->BitmapIdx = bitmapIdx;
-        pMap[mapIdx] = bitmapIdx;
+        if (!Tiles.IsValid(mapIdx)) return;
+        if (bitmapIdx < 0 || bitmapIdx >= static_cast<int>(Tiles.SrcRects.size())) return;
 
-        Texture& mapTex = RM.GetTex(ResourceManager::ResID_Tile);
-        int mapTexW = static_cast<int>(mapTex.W);
-        int mapTileTexW = mapTexW / Tile::SourceBitmapTileSize;
-        float srcX = static_cast<float>((bitmapIdx % mapTileTexW) * Tile::SourceBitmapTileSize);
-        float srcY = static_cast<float>((bitmapIdx / mapTileTexW) * Tile::SourceBitmapTileSize);
-        pTile->TexSrcRect = { srcX, srcY, static_cast<float>(Tile::SourceBitmapTileSize), static_cast<float>(Tile::SourceBitmapTileSize) };
+        if (!Tiles.SetBitmapIdx(mapIdx, static_cast<Uint16>(bitmapIdx)))
+            return;
+
+        int i = mapIdx % MapW;
+        int j = mapIdx / MapW;
+        InvalidateTerrain(i, j, i, j);
     }
 
     bool PlayerMoveLeft()
@@ -904,6 +3913,11 @@ public:
     bool HandleInput(const SDL_Event& event)
     {
         bool isHandled = false;
+        // Lost terrain targets are redrawn (or recreated) as they come into view again.
+        if (event.type == SDL_EVENT_RENDER_TARGETS_RESET)
+            InvalidateAllTerrain();
+        if (event.type == SDL_EVENT_RENDER_DEVICE_RESET)
+            ReleaseTerrainBlocks();
         if (event.type == SDL_EVENT_KEY_DOWN)
         {
             if (event.key.key == SDLK_RIGHT || event.key.key == SDLK_KP_6)
@@ -916,8 +3930,30 @@ public:
                 isHandled = true;
             }
         }
+        if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN && event.button.button == SDL_BUTTON_RIGHT)
+        {
+            bDragging = true;
+            isHandled = true;
+        }
+        if (event.type == SDL_EVENT_MOUSE_MOTION)
+        {
+            if (bDragging)
+            {
+                // Drags follow the mouse immediately instead of waiting for the next view tick.
+                Cam.Pan(-event.motion.xrel, -event.motion.yrel);
+                PrevTickCam.Pan(-event.motion.xrel, -event.motion.yrel);
+                ViewCam.Pan(-event.motion.xrel, -event.motion.yrel);
+                isHandled = true;
+            }
+            HoveredIndex = GetTileAtPosition(event.motion.x, event.motion.y);
+        }
         if (event.type == SDL_EVENT_MOUSE_BUTTON_UP)
         {
+            if (event.button.button == SDL_BUTTON_RIGHT)
+            {
+                bDragging = false;
+                isHandled = true;
+            }
             if (event.button.button == SDL_BUTTON_LEFT)
             {
                 float x = static_cast<float>(event.button.x);
@@ -925,15 +3961,12 @@ public:
 
                 std::cout << "Mouse Click at screen coordinates: x=" << x << ", y=" << y << std::endl;
 
-                for (auto& pTile : vTileMap)
+                int mapIdx = GetTileAtPosition(x, y);
+                if (mapIdx >= 0)
                 {
-                    if (pTile->IsInHex(x, y, HEX_SIDE_LENGTH))
-                    {
-                        std::cout << "Click detected in hexagonal map tile with index: " << pTile->MapIdx << std::endl;
-                        SelectedIndex = pTile->MapIdx;
-                        isHandled = true;
-                        break;
-                    }
+                    std::cout << "Click detected in hexagonal map tile with index: " << mapIdx << std::endl;
+                    SelectedIndex = mapIdx;
+                    isHandled = true;
                 }
             }
         }
@@ -941,34 +3974,172 @@ public:
         return isHandled;
     }
 
+    void GetPanInput(float& dx, float& dy) const
+    {
+        const bool* keys = SDL_GetKeyboardState(nullptr);
+        dx = dy = 0;
+        if (keys[SDL_SCANCODE_A] || keys[SDL_SCANCODE_LEFT]) dx -= CameraPanSpeed;
+        if (keys[SDL_SCANCODE_D] || keys[SDL_SCANCODE_RIGHT]) dx += CameraPanSpeed;
+        if (keys[SDL_SCANCODE_W] || keys[SDL_SCANCODE_UP]) dy -= CameraPanSpeed;
+        if (keys[SDL_SCANCODE_S] || keys[SDL_SCANCODE_DOWN]) dy += CameraPanSpeed;
+    }
+
+    void UpdateCamera()
+    {
+        float dx, dy;
+        GetPanInput(dx, dy);
+        if (dx != 0 || dy != 0)
+            Cam.Pan(dx, dy);
+    }
+
+    // View ticks change nothing while the camera rests, no pan key is held and no chunk or castle is on its way.
+    bool IsViewIdle() const
+    {
+        float dx, dy;
+        GetPanInput(dx, dy);
+        return dx == 0 && dy == 0 && PrevTickCam.X == Cam.X && PrevTickCam.Y == Cam.Y && Tiles.RequestedCount == 0 && !Streamer.HasCastlesToCome();
+    }
+
+    // Simulation ticks until one changes something without new input: the next economy month.
+    // -1 when no tick ever will.
+    int GetSimTicksUntilWork() const
+    {
+        return World.Economy.Size() > 0 ? TicksPerMonth - EconomyTicks : -1;
+    }
+
+    // Simulation tick; runs SimSpeed times per real-time tick while fast-forwarding.
     void Update() override
     {
-        for (Object* obj : objects)
-            obj->Update();
+        LifecycleSystem();
+        EconomySystem();
+    }
 
-        objects.erase(std::remove_if(objects.begin(), objects.end(), [](Object* obj) {
-            if (!obj->show)
-            {
-                delete obj;
-                return true;
-            }
-            return false;
-        }), objects.end());
+    // View tick at real-time rate, so panning and streaming do not speed up with the simulation.
+    void UpdateView()
+    {
+        // The frames of the last interval were interpolated towards Cam, so one more redraw is
+        // due after the camera stops to land exactly on it.
+        bool bWasMoving = PrevTickCam.X != Cam.X || PrevTickCam.Y != Cam.Y;
+        PrevTickCam = Cam;
+        UpdateCamera();
+        if (bWasMoving || PrevTickCam.X != Cam.X || PrevTickCam.Y != Cam.Y)
+            Redraw.Invalidate();
+        UpdateStreaming();
+    }
+
+    void SetViewAlpha(float Alpha) { ViewAlpha = Alpha; }
+
+    void EconomySystem()
+    {
+        if (++EconomyTicks < TicksPerMonth)
+            return;
+        EconomyTicks = 0;
+        World.Economy.Tick();
+    }
+
+    // Scans only the dense sprite array for hidden entities and destroys them as one batch.
+    void LifecycleSystem()
+    {
+        const SpriteComponent* pSprites = World.Sprites.Data();
+        for (size_t k = 0; k < World.Sprites.Size(); ++k)
+        {
+            if (!pSprites[k].bShow)
+                PendingDestroy.push_back(World.HandleOf(World.Sprites.EntityAt(k)));
+        }
+
+        for (Entity e : PendingDestroy)
+        {
+            if (const CellComponent* pCell = World.Cells.Get(e.Index))
+                EntityIndex.Remove(e, pCell->MapIndex);
+            World.Destroy(e);
+        }
+        if (!PendingDestroy.empty())
+            Redraw.Invalidate();
+        PendingDestroy.clear();
     }
 
     void Render(RenderInterface* RI) override
     {
-        for (int j = 0; j < MapH; ++j)
+        ProfileScope zone("Level::Render");
+        ViewCam = Camera::Lerp(PrevTickCam, Cam, ViewAlpha);
+        if (PrevTickCam.X != Cam.X || PrevTickCam.Y != Cam.Y)
+            Redraw.Invalidate(); // Mid-pan, so the next frame interpolates to a new spot as well
+        // Whole pixels, so the cached terrain is blitted 1:1 and stays sharp.
+        ViewCam.X = std::round(ViewCam.X);
+        ViewCam.Y = std::round(ViewCam.Y);
+
+        int minCol, maxCol, minRow, maxRow;
+        GetVisibleRange(ViewCam, minCol, maxCol, minRow, maxRow);
+        if (minCol > maxCol || minRow > maxRow)
+            return;
+
+        if (DM.bShowObjectRect)
         {
-            for (int i = 0; i < MapW; ++i)
+            // Debug overlay needs per-tile rects and labels, so keep the per-tile path here.
+            for (int j = minRow; j <= maxRow; ++j)
             {
-                int idx = j * MapW + i;
-                RI->RenderTile(vTileMap[idx], i, j, MapW, MapH, SelectedIndex==idx);
+                for (int i = minCol; i <= maxCol; ++i)
+                {
+                    int idx = j * MapW + i;
+                    if (!Tiles.IsResident(idx))
+                        continue;
+                    RI->RenderTile(Tile(&Tiles, idx), ViewCam.WorldToScreen(TileStore::GetDestRect(i, j)), i, j, MapW, MapH, SelectedIndex==idx);
+                }
+            }
+        }
+        else
+        {
+            ++RenderFrame;
+            Uint32 tileTexVersion = RM.GetTex(ResourceManager::ResID_Tile).Version;
+            if (TerrainTexVersion != tileTexVersion)
+            {
+                InvalidateAllTerrain();
+                TerrainTexVersion = tileTexVersion;
+            }
+
+            for (int by = minRow >> TerrainBlockShift; by <= maxRow >> TerrainBlockShift; ++by)
+            {
+                for (int bx = minCol >> TerrainBlockShift; bx <= maxCol >> TerrainBlockShift; ++bx)
+                {
+                    TerrainBlock* pBlock = GetTerrainBlock(bx, by);
+                    if (!pBlock)
+                        continue;
+                    SDL_FRect dst = ViewCam.WorldToScreen(GetTerrainBlockRect(bx, by));
+                    RI->RenderTexture(&pBlock->Target, &dst);
+                }
+            }
+            EvictTerrainBlocks();
+
+            if (Tiles.IsValid(HoveredIndex) && HoveredIndex != SelectedIndex && IsTileVisible(HoveredIndex))
+            {
+                SDL_FRect hoverRect = ViewCam.WorldToScreen(Tiles.GetDestRect(HoveredIndex));
+                RI->RenderBox(&hoverRect, 128, 128, 128, 255);
+            }
+            if (Tiles.IsValid(SelectedIndex) && IsTileVisible(SelectedIndex))
+            {
+                SDL_FRect selRect = ViewCam.WorldToScreen(Tiles.GetDestRect(SelectedIndex));
+                RI->RenderBox(&selRect, 255, 0, 0, 255);
             }
         }
 
-        for (Object* obj : objects)
-            RI->RenderObject(obj, vTileMap[obj->MapIndex], SelectedIndex == obj->MapIndex);
+        // Sprite system: visit only visible cells through the index, so cost follows the viewport, not the unit count.
+        for (int j = minRow; j <= maxRow; ++j)
+        {
+            for (int i = minCol; i <= maxCol; ++i)
+            {
+                int idx = j * MapW + i;
+                const std::vector<Entity>& cellEntities = EntityIndex.At(idx);
+                if (cellEntities.empty())
+                    continue;
+                SDL_FRect destRect = ViewCam.WorldToScreen(TileStore::GetDestRect(i, j));
+                for (Entity e : cellEntities)
+                {
+                    const SpriteComponent* pSprite = World.Sprites.Get(e.Index);
+                    if (pSprite && pSprite->Tex)
+                        RI->RenderSprite(pSprite->Tex.Get(), pSprite->SrcRect, destRect, SelectedIndex == idx);
+                }
+            }
+        }
     }
 };
 
@@ -978,17 +4149,30 @@ class GameState : public SubSystem, public InputHandler
 {
 protected:
     StateManager* pSM = nullptr;
+    UIRoot* pUI = nullptr; // The state's window tree, created by Init
 public:
     GameState(StateManager* pStateMgr) { pSM = pStateMgr; }
     virtual void Init(const Viewport& VP, RenderInterface* RI) = 0;
     virtual void Destroy() = 0;
     virtual size_t GetObjNum() const { return 0; }
+    virtual void UpdateView() {}
+    virtual void SetViewAlpha(float) {}
+    virtual bool IsViewIdle() const { return true; }
+    virtual int GetSimTicksUntilWork() const { return -1; }
     void GotoMenuState();
     void GotoPlayingState();
     void SaveMap();
     void LoadMap();
+
+    void ResetWindowCaches(bool bReleaseTargets)
+    {
+        if (pUI)
+            pUI->ResetCaches(bReleaseTargets);
+    }
 };
 
+// The button art is part of the menu texture; each button is an invisible child window that
+// only outlines itself while hovered.
 class CastleMenuWnd : public Window
 {
     static const int ButtonCount = 6;
@@ -997,43 +4181,18 @@ class CastleMenuWnd : public Window
     static constexpr float BtnH = 30.0f;
     static constexpr float BtnStartY = 6.0f;
     static constexpr float BtnStride = 34.0f;
-    int HoveredButton = -1;
 
 public:
     CastleMenuWnd(const std::string& a_Title, const SDL_FRect& a_Size, RenderInterface* a_RI)
-        : Window(a_Title, a_Size, a_RI) {}
-
-    void UpdateHover(float mouseX, float mouseY)
+        : Window(a_Title, a_Size, a_RI)
     {
-        HoveredButton = -1;
-        if (!bShow) return;
+        bHighlightOnHover = false;
         for (int i = 0; i < ButtonCount; ++i)
         {
-            SDL_FRect btnRect = {
-                Rect.x + BtnX,
-                Rect.y + BtnStartY + i * BtnStride,
-                BtnW, BtnH
-            };
-            if (mouseX >= btnRect.x && mouseX <= btnRect.x + btnRect.w &&
-                mouseY >= btnRect.y && mouseY <= btnRect.y + btnRect.h)
-            {
-                HoveredButton = i;
-                break;
-            }
+            Window* pButton = AddChild(new Window("", { BtnX, BtnStartY + i * BtnStride, BtnW, BtnH }, a_RI));
+            pButton->bDrawBackground = false;
         }
     }
-
-    void Render(RenderInterface* a_RI) override
-    {
-        Window::Render(a_RI);
-        if (!bShow || HoveredButton < 0) return;
-        SDL_FRect btnRect = {
-            Rect.x + BtnX,
-            Rect.y + BtnStartY + HoveredButton * BtnStride,
-            BtnW, BtnH
-        };
-        a_RI->RenderBox(&btnRect, 255, 0, 0, 255);
-    }
 };
 
 class GameStatePlaying : public GameState
@@ -1042,57 +4201,74 @@ class GameStatePlaying : public GameState
 
     int lastSelectedIndex = -1;
 
-    std::vector<Window*> vpWindowArray;
     CastleInfoWnd* pCastleInfoWnd = nullptr;
     CastleMenuWnd* pCastleMenuWnd = nullptr;
 public:
     GameStatePlaying(StateManager* pSM) : GameState(pSM) {}
     void Init(const Viewport& VP, RenderInterface* RI) override
     {
-        Stage.Init(VP);
+        Stage.Init(VP, RI);
+        pUI = new UIRoot(VP, RI, this);
 
         pCastleInfoWnd = new CastleInfoWnd(u8"성 정보", { static_cast<float>(VP.WIDTH - 300), 100.f, 230.f, 300.f }, RI);
         pCastleInfoWnd->Init(u8"허창", 1000, 2000);
-        vpWindowArray.push_back(pCastleInfoWnd);
+        pUI->AddChild(pCastleInfoWnd);
 
+        // Pops up at the click, so it stays in front of the info panel.
         pCastleMenuWnd = new CastleMenuWnd("", { static_cast<float>(VP.WIDTH - 300), 400.f, 88.f, 214.f }, RI);
-        pCastleMenuWnd->SetTexture(&RM.GetTex(ResourceManager::ResID_CastleMenu));
+        pCastleMenuWnd->SetTexture(RM.Acquire(ResourceManager::ResID_CastleMenu));
         pCastleMenuWnd->bShow = false;
-        vpWindowArray.push_back(pCastleMenuWnd);
+        pUI->AddChild(pCastleMenuWnd, 1);
     }
 
     void Destroy() override
     {
         Stage.Destroy();
-        for (auto& wnd : vpWindowArray)
-            delete wnd;
-        vpWindowArray.clear();
+        delete pUI;
+        pUI = nullptr;
         pCastleInfoWnd = nullptr;
         pCastleMenuWnd = nullptr;
     }
 
     size_t GetObjNum() const override { return Stage.GetObjNum(); }
 
-    void SaveMap() { Stage.SaveMap("savemap.txt"); }
-    void LoadMap() { Stage.LoadMap("savemap.txt"); }
+    void SaveMap() { Stage.SaveMap("savemap.hxmap"); }
+    void LoadMap() { Stage.LoadMap(std::ifstream("savemap.hxmap").is_open() ? "savemap.hxmap" : "savemap.txt"); }
+    void LoadMap(const std::string& filename) { Stage.LoadMap(filename); }
     int GetTileAtPosition(float x, float y) { return Stage.GetTileAtPosition(x, y); }
+    void GetTilesAtPositions(const SDL_FPoint* pPoints, int Count, int* pOutIdx) { Stage.GetTilesAtPositions(pPoints, Count, pOutIdx); }
     void SetTileBitmapIdx(int mapIdx, int bitmapIdx) { Stage.SetTileBitmapIdx(mapIdx, bitmapIdx); }
 
     void Update() override
     {
         Stage.Update();
+        // Economy months change numbers all over the map, but only the shown castle's matter.
+        if (pCastleInfoWnd->bShow && pCastleInfoWnd->IsContentStale())
+            Redraw.Invalidate();
     }
+    void UpdateView() override { Stage.UpdateView(); }
+    void SetViewAlpha(float Alpha) override { Stage.SetViewAlpha(Alpha); }
+    bool IsViewIdle() const override { return Stage.IsViewIdle(); }
+    int GetSimTicksUntilWork() const override { return Stage.GetSimTicksUntilWork(); }
     void Render(RenderInterface* RI) override
     {
         Stage.Render(RI);
-        for (auto& wnd : vpWindowArray)
-            wnd->Render(RI);
+        ProfileScope zone("Window::Render");
+        pUI->RenderWindows();
     }
     bool HandleInput(const SDL_Event& event) override
     {
         bool isHandled = false;
 
-        isHandled = Stage.HandleInput(event);
+        // Windows get left clicks first; motion and other buttons always reach the map so a
+        // drag keeps working over a window.
+        if (event.type == SDL_EVENT_MOUSE_MOTION)
+            pUI->UpdateHover(event.motion.x, event.motion.y);
+        else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN || event.type == SDL_EVENT_MOUSE_BUTTON_UP)
+            isHandled = pUI->Dispatch(event, event.button.x, event.button.y);
+
+        if (!isHandled)
+            isHandled = Stage.HandleInput(event);
 
         if (Stage.SelectedIndex != -1)
         {
@@ -1122,11 +4298,6 @@ public:
 
         lastSelectedIndex = Stage.SelectedIndex;
 
-        if (event.type == SDL_EVENT_MOUSE_MOTION)
-        {
-            pCastleMenuWnd->UpdateHover(event.motion.x, event.motion.y);
-        }
-
         if (event.type == SDL_EVENT_KEY_DOWN)
         {
             if (event.key.key == SDLK_F10)
@@ -1178,46 +4349,37 @@ public:
 
 class GameStateMenu : public GameState
 {
-    std::vector<Window*> vpWindowArray;
 public:
     GameStateMenu(StateManager* pSM) : GameState(pSM) {}
     void Init(const Viewport& VP, RenderInterface* RI) override
     {
+        pUI = new UIRoot(VP, RI, this);
+
         const float menuWndW = 150;
         const float menuWndH = 208;
         Location start = { VP.WIDTH / 2.0f - menuWndW / 2.0f, 100.0f };
 
-        Window* pMenuWnd = new Window("", { start.x, start.y, menuWndW, menuWndH }, RI);
-        pMenuWnd->SetTexture(&RM.GetTex(ResourceManager::ResID_GameMenu));
-        vpWindowArray.push_back(pMenuWnd);
+        Window* pMenuWnd = pUI->AddChild(new Window("", { start.x, start.y, menuWndW, menuWndH }, RI));
+        pMenuWnd->SetTexture(RM.Acquire(ResourceManager::ResID_GameMenu));
 
+        // Buttons are placed relative to the menu background.
         const float btnWndW = 140;
         const float btnWndH = 26;
-
-        Location saveBtnLoc = { pMenuWnd->TexDestRect.x + 6, pMenuWnd->TexDestRect.y + 88 };
-        Window* pSaveMapWnd = new SaveMapWnd(u8"저장", { saveBtnLoc.x, saveBtnLoc.y, btnWndW, btnWndH }, RI);
-        vpWindowArray.push_back(pSaveMapWnd);
-
-        Location loadBtnLoc = { pMenuWnd->TexDestRect.x + 6, pMenuWnd->TexDestRect.y + 116 };
-        Window* pLoadMapWnd = new LoadMapWnd(u8"로드", { loadBtnLoc.x, loadBtnLoc.y, btnWndW, btnWndH }, RI);
-        vpWindowArray.push_back(pLoadMapWnd);
-
-        Location btnLoc = { pMenuWnd->TexDestRect.x + 6, pMenuWnd->TexDestRect.y + 144 };
-        Window* pReturnToGameWnd = new ReturnToGameWnd("", { btnLoc.x, btnLoc.y, btnWndW, btnWndH }, RI);
-        vpWindowArray.push_back(pReturnToGameWnd);
+        pMenuWnd->AddChild(new SaveMapWnd(u8"저장", { 6, 88, btnWndW, btnWndH }, RI));
+        pMenuWnd->AddChild(new LoadMapWnd(u8"로드", { 6, 116, btnWndW, btnWndH }, RI));
+        pMenuWnd->AddChild(new ReturnToGameWnd("", { 6, 144, btnWndW, btnWndH }, RI));
     }
 
     void Destroy() override
     {
-        for (auto& pWnd : vpWindowArray)
-            delete pWnd;
-        vpWindowArray.clear();
+        delete pUI;
+        pUI = nullptr;
     }
     void Update() override {}
-    void Render(RenderInterface* RI) override
+    void Render(RenderInterface*) override
     {
-        for (auto& wnd : vpWindowArray)
-            wnd->Render(RI);
+        ProfileScope zone("Window::Render");
+        pUI->RenderWindows();
     }
     bool HandleInput(const SDL_Event& event) override
     {
@@ -1237,30 +4399,9 @@ public:
         }
 
         if (event.type == SDL_EVENT_MOUSE_MOTION)
-        {
-            float x = event.motion.x;
-            float y = event.motion.y;
-            for (auto& wnd : vpWindowArray)
-                wnd->bHovered = wnd->IsIn(x, y);
-        }
-
-        if (event.type == SDL_EVENT_MOUSE_BUTTON_UP)
-        {
-            if (event.button.button == SDL_BUTTON_LEFT)
-            {
-                float x = static_cast<float>(event.button.x);
-                float y = static_cast<float>(event.button.y);
-                for (auto it = vpWindowArray.rbegin(); it != vpWindowArray.rend(); ++it)
-                {
-                    if ((*it)->IsIn(x, y))
-                    {
-                        (*it)->Execute(this);
-                        isHandled = true;
-                        break;
-                    }
-                }
-            }
-        }
+            pUI->UpdateHover(event.motion.x, event.motion.y);
+        else if (event.type == SDL_EVENT_MOUSE_BUTTON_DOWN || event.type == SDL_EVENT_MOUSE_BUTTON_UP)
+            isHandled = pUI->Dispatch(event, event.button.x, event.button.y);
 
         return isHandled;
     }
@@ -1318,14 +4459,30 @@ public:
 
     void SaveMap() { pGameStatePlaying->SaveMap(); }
     void LoadMap() { pGameStatePlaying->LoadMap(); }
+    void LoadMap(const std::string& filename) { pGameStatePlaying->LoadMap(filename); }
     int GetTileAtPosition(float x, float y) { return pGameStatePlaying->GetTileAtPosition(x, y); }
+    void GetTilesAtPositions(const SDL_FPoint* pPoints, int Count, int* pOutIdx) { pGameStatePlaying->GetTilesAtPositions(pPoints, Count, pOutIdx); }
     void SetTileBitmapIdx(int mapIdx, int bitmapIdx) { pGameStatePlaying->SetTileBitmapIdx(mapIdx, bitmapIdx); }
 
     void Update() override
     {
+        ProfileScope zone("StateManager::Update");
         if (State)
             State->Update();
     }
+    void UpdateView()
+    {
+        ProfileScope zone("StateManager::UpdateView");
+        if (State)
+            State->UpdateView();
+    }
+    void SetViewAlpha(float Alpha)
+    {
+        if (State)
+            State->SetViewAlpha(Alpha);
+    }
+    bool IsViewIdle() const { return !State || State->IsViewIdle(); }
+    int GetSimTicksUntilWork() const { return State ? State->GetSimTicksUntilWork() : -1; }
 
     void Render(RenderInterface* RI) override
     {
@@ -1336,6 +4493,12 @@ public:
     bool HandleInput(const SDL_Event& event) override
     {
         bool isHandled = false;
+        // Window caches of the inactive state are lost as well, so every state hears of it.
+        if (event.type == SDL_EVENT_RENDER_TARGETS_RESET || event.type == SDL_EVENT_RENDER_DEVICE_RESET)
+        {
+            pGameStatePlaying->ResetWindowCaches(event.type == SDL_EVENT_RENDER_DEVICE_RESET);
+            pGameStateMenu->ResetWindowCaches(event.type == SDL_EVENT_RENDER_DEVICE_RESET);
+        }
         if (State) isHandled = State->HandleInput(event);
         return isHandled;
     }
@@ -1363,73 +4526,165 @@ class Game
 {
     RenderInterface* RI;
     Viewport VP;
+    bool bHeadless;
 
     StateManager StateMgr;
 
     bool bEditMode = false;
     int SelectedBitmapIdx = -1;
 
+    // Editor paint stroke: motion samples between events so fast drags leave no gaps.
+    bool bPainting = false;
+    SDL_FPoint LastPaintPos = { 0, 0 };
+    std::vector<SDL_FPoint> StrokePoints;
+    std::vector<int> StrokeTiles;
+
+    // Fixed-timestep loop. The view (camera, streaming) ticks at real-time rate and is drawn
+    // interpolated between its last two ticks; the simulation ticks SimSpeed times as often.
+    // Frame time is clamped to MaxFrameNS and the simulation gets at most SimBudgetNS per frame,
+    // dropping whatever it cannot catch up on, so a slow frame never snowballs into slower ones.
+    static constexpr Uint64 TickNS = SDL_NS_PER_SECOND / 60;
+    static constexpr Uint64 MaxFrameNS = SDL_NS_PER_SECOND / 4;
+    static constexpr Uint64 SimBudgetNS = 12 * SDL_NS_PER_MS;
+    static constexpr Uint64 MinFrameNS = SDL_NS_PER_SECOND / 240;
+    static constexpr int MaxSimSpeed = 64;
+    int SimSpeed = 1;
+    Uint64 ViewAccumulator = 0;
+    Uint64 SimAccumulator = 0;
+    Uint64 SimTicks = 0;
+
+    // On-demand rendering: frames are drawn only while Redraw is dirty, and an idle loop sleeps
+    // in SDL_WaitEventTimeout until the next event or the next tick that has work, instead of
+    // spinning. F6 toggles it.
+    bool bOnDemandRendering = true;
+    bool bInputSinceSimTick = false; // Input may leave work for the next simulation tick (hidden sprites)
+    // Set by WaitForWork when the view or the simulation had nothing due while it waited; the
+    // ticks slept through would have changed nothing, so they are dropped rather than run late.
+    bool bViewSlept = false;
+    bool bSimSlept = false;
+
 public:
-    Game() : Fps(nullptr) {}
+    explicit Game(bool a_bHeadless = false) : bHeadless(a_bHeadless), Fps(nullptr) {}
 
 private:
     class FPS : public SubSystem
     {
         Uint64 lastFrameTime = 0;
-        __int64 fps = 0;
-
-        SDL_Texture* ObjectCountTex = nullptr;
-        SDL_Texture* FPSTex = nullptr;
-
-        SDL_FRect ObjectCountRect;
-        SDL_FRect FPSRect;
+        double avgFrameNS = 0; // Exponentially smoothed frame time
+        Sint64 fps = 0;
+
+        Uint64 speedWindowStart = 0;
+        Uint64 speedWindowTicks = 0;
+
+        int ObjectCountLabel = -1;
+        int FPSLabel = -1;
+        int TextureLabel = -1;
+        int SpeedLabel = -1;
+        size_t prevObjectCount = 0;
+        Sint64 prevFps = -1;
+        // What the texture and speed labels show; the text is rebuilt only when one of these changes.
+        size_t prevResidentKB = 0;
+        size_t prevBudgetKB = 0;
+        int prevResident = -1;
+        Uint64 prevHitPercent = 0;
+        int prevSimSpeed = 0;
+        Uint64 prevTicksPerSecond = 0;
 
         RenderInterface* RI = nullptr;
 
     public:
         size_t ObjectCount = 0;
+        int SimSpeed = 1;
+        Uint64 SimTicks = 0;
+        Uint64 TicksPerSecond = 0;
 
-        FPS(RenderInterface* a_RI) : RI(a_RI) {}
+        FPS(RenderInterface* a_RI) : RI(a_RI)
+        {
+            ObjectCountLabel = RI->CreateLabel();
+            FPSLabel = RI->CreateLabel();
+            TextureLabel = RI->CreateLabel();
+            SpeedLabel = RI->CreateLabel();
+        }
+        // Once per loop iteration; the labels it changes mark the frame dirty.
         void Update() override
         {
-            Uint64 currentFrameTime = SDL_GetTicks();
-            if (lastFrameTime == 0) {
-                lastFrameTime = currentFrameTime;
+            Uint64 currentTime = SDL_GetTicksNS();
+            if (speedWindowStart == 0) {
+                speedWindowStart = currentTime;
+                speedWindowTicks = SimTicks;
+            }
+            if (currentTime - speedWindowStart >= SDL_NS_PER_SECOND)
+            {
+                TicksPerSecond = (SimTicks - speedWindowTicks) * SDL_NS_PER_SECOND / (currentTime - speedWindowStart);
+                speedWindowStart = currentTime;
+                speedWindowTicks = SimTicks;
             }
-            Uint64 deltaTime = currentFrameTime - lastFrameTime;
-            if (deltaTime > 0)
-                fps = 1000 / deltaTime;
-            lastFrameTime = currentFrameTime;
 
-            static size_t prevObjectCount = 0;
-            static __int64 prevFps = 0;
+            if (ObjectCount != prevObjectCount || prevFps < 0)
+            {
+                RI->SetLabelText(ObjectCountLabel, "Object count: " + std::to_string(ObjectCount));
+                Redraw.Invalidate();
+            }
 
-            if (ObjectCount != prevObjectCount || fps != prevFps)
+            const ResourceStats& stats = RM.GetStats();
+            Uint64 uses = stats.Hits + stats.Misses;
+            size_t residentKB = stats.ResidentBytes / 1024;
+            size_t budgetKB = stats.BudgetBytes / 1024;
+            Uint64 hitPercent = uses ? stats.Hits * 100 / uses : 100;
+            if (residentKB != prevResidentKB || budgetKB != prevBudgetKB || stats.Resident != prevResident || hitPercent != prevHitPercent)
             {
-                SDLRenderInterface* ri = static_cast<SDLRenderInterface*>(RI);
-                Viewport* vp = ri->GetViewport();
+                RI->SetLabelText(TextureLabel, "Textures: " + std::to_string(residentKB) + "/" + std::to_string(budgetKB) +
+                    " KB, " + std::to_string(stats.Resident) + " resident, hits " + std::to_string(hitPercent) + "%");
+                prevResidentKB = residentKB;
+                prevBudgetKB = budgetKB;
+                prevResident = stats.Resident;
+                prevHitPercent = hitPercent;
+                Redraw.Invalidate();
+            }
 
-                if (ObjectCountTex) SDL_DestroyTexture(ObjectCountTex);
-                ObjectCountTex = ri->CreateTextTexture("Object count: " + std::to_string(ObjectCount), &ObjectCountRect, static_cast<float>(vp->WIDTH - 100), 10.f);
+            if (SimSpeed != prevSimSpeed || TicksPerSecond != prevTicksPerSecond)
+            {
+                RI->SetLabelText(SpeedLabel, "Speed: x" + std::to_string(SimSpeed) + ", " + std::to_string(TicksPerSecond) + " ticks/s");
+                prevSimSpeed = SimSpeed;
+                prevTicksPerSecond = TicksPerSecond;
+                Redraw.Invalidate();
+            }
 
-                if (FPSTex) SDL_DestroyTexture(FPSTex);
-                FPSTex = ri->CreateTextTexture("FPS: " + std::to_string(fps), &FPSRect, static_cast<float>(vp->WIDTH - 60), 40.f);
+            prevObjectCount = ObjectCount;
+        }
 
-                prevObjectCount = ObjectCount;
-                prevFps = fps;
+        // Once per drawn frame, so with on-demand rendering the counter shows redraws rather than
+        // loop iterations. Not a reason to redraw by itself, or an idle screen would never settle.
+        void CountFrame()
+        {
+            Uint64 currentFrameTime = SDL_GetTicksNS();
+            if (lastFrameTime != 0 && currentFrameTime > lastFrameTime)
+            {
+                Uint64 deltaTime = currentFrameTime - lastFrameTime;
+                avgFrameNS = avgFrameNS > 0 ? avgFrameNS * 0.9 + deltaTime * 0.1 : static_cast<double>(deltaTime);
+                fps = static_cast<Sint64>(SDL_NS_PER_SECOND / avgFrameNS + 0.5);
             }
+            lastFrameTime = currentFrameTime;
+
+            if (fps != prevFps)
+                RI->SetLabelText(FPSLabel, "FPS: " + std::to_string(fps));
+            prevFps = fps;
         }
         void Render(RenderInterface* RI) override
         {
-            SDL_Renderer* renderer = static_cast<SDL_Renderer*>(RI->GetRenderer());
-            if (ObjectCountTex) SDL_RenderTexture(renderer, ObjectCountTex, nullptr, &ObjectCountRect); // Changed NULL to nullptr
-            if (FPSTex) SDL_RenderTexture(renderer, FPSTex, nullptr, &FPSRect); // Changed NULL to nullptr
+            Viewport* vp = RI->GetViewport();
+            RI->RenderLabel(ObjectCountLabel, static_cast<float>(vp->WIDTH - 100), 10.f, 0.0f);
+            RI->RenderLabel(FPSLabel, static_cast<float>(vp->WIDTH - 60), 40.f, 0.0f);
+            RI->RenderLabel(TextureLabel, static_cast<float>(vp->WIDTH - 10), 70.f, 0.0f, HAlign::Right);
+            RI->RenderLabel(SpeedLabel, static_cast<float>(vp->WIDTH - 10), 100.f, 0.0f, HAlign::Right);
         }
 
         ~FPS()
         {
-            if (ObjectCountTex) SDL_DestroyTexture(ObjectCountTex);
-            if (FPSTex) SDL_DestroyTexture(FPSTex);
+            RI->DestroyLabel(ObjectCountLabel);
+            RI->DestroyLabel(FPSLabel);
+            RI->DestroyLabel(TextureLabel);
+            RI->DestroyLabel(SpeedLabel);
         }
     };
 
@@ -1443,7 +4698,7 @@ private:
 
     void init()
     {
-        RI = new SDLRenderInterface();
+        RI = new SDLRenderInterface(bHeadless);
         if (!RI->CreateRenderer(&VP)) {
             std::cerr << "Failed to create renderer. Exiting." << std::endl;
             exit(1);
@@ -1452,13 +4707,53 @@ private:
         Fps = new FPS(RI);
     }
 
-    int Update()
+    bool IsOverPalette(float x, float y) const
+    {
+        Texture& tileTex = RM.GetTex(ResourceManager::ResID_Tile);
+        float scale = HEX_FLAT_TOP_WIDTH / Tile::SourceBitmapTileSize;
+        float scaledW = tileTex.W * scale;
+        float scaledH = tileTex.H * scale;
+        float paletteX = VP.WIDTH - scaledW;
+        float paletteY = VP.HEIGHT - scaledH;
+        return x >= paletteX && x < paletteX + scaledW && y >= paletteY && y < paletteY + scaledH;
+    }
+
+    void PaintStroke(const SDL_FPoint& To)
+    {
+        float dx = To.x - LastPaintPos.x;
+        float dy = To.y - LastPaintPos.y;
+        int steps = std::max(1, static_cast<int>(std::ceil(std::sqrt(dx * dx + dy * dy) / (HEX_SIDE_LENGTH * 0.5f))));
+
+        StrokePoints.resize(steps);
+        for (int k = 0; k < steps; ++k)
+        {
+            float t = static_cast<float>(k + 1) / steps;
+            StrokePoints[k] = { LastPaintPos.x + dx * t, LastPaintPos.y + dy * t };
+        }
+        StrokeTiles.resize(steps);
+        StateMgr.GetTilesAtPositions(StrokePoints.data(), steps, StrokeTiles.data());
+
+        int lastIdx = -1;
+        for (int k = 0; k < steps; ++k)
+        {
+            int mapIdx = StrokeTiles[k];
+            if (mapIdx >= 0 && mapIdx != lastIdx && !IsOverPalette(StrokePoints[k].x, StrokePoints[k].y))
+                StateMgr.SetTileBitmapIdx(mapIdx, SelectedBitmapIdx);
+            lastIdx = mapIdx;
+        }
+        LastPaintPos = To;
+    }
+
+    int PollEvents()
     {
+        ProfileScope zone("Events");
         SDL_Event event;
         int quit = 0;
 
         while (SDL_PollEvent(&event))
         {
+            Redraw.Invalidate();
+            bInputSinceSimTick = true;
             if (event.type == SDL_EVENT_QUIT)
                 quit = 1;
             else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F8)
@@ -1467,8 +4762,32 @@ private:
                 RI->SetWindowTitle(bEditMode ? "Hexagon Map Game [Edit Mode]" : "Hexagon Map Game [Game Mode]");
                 if (!bEditMode) SelectedBitmapIdx = -1;
             }
+            else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F7)
+            {
+                Prof.bShowOverlay = !Prof.bShowOverlay;
+            }
+            else if (event.type == SDL_EVENT_KEY_DOWN && event.key.key == SDLK_F6)
+            {
+                bOnDemandRendering = !bOnDemandRendering;
+            }
+            else if (event.type == SDL_EVENT_KEY_DOWN && (event.key.key == SDLK_PAGEUP || event.key.key == SDLK_PAGEDOWN))
+            {
+                SimSpeed = event.key.key == SDLK_PAGEUP ? std::min(SimSpeed * 2, MaxSimSpeed) : std::max(SimSpeed / 2, 1);
+            }
+            else if (bEditMode && SelectedBitmapIdx >= 0 && event.type == SDL_EVENT_MOUSE_BUTTON_DOWN && event.button.button == SDL_BUTTON_LEFT && !IsOverPalette(event.button.x, event.button.y))
+            {
+                bPainting = true;
+                LastPaintPos = { event.button.x, event.button.y };
+                PaintStroke(LastPaintPos);
+            }
+            else if (bPainting && event.type == SDL_EVENT_MOUSE_MOTION)
+            {
+                PaintStroke({ event.motion.x, event.motion.y });
+                StateMgr.HandleInput(event);
+            }
             else if (bEditMode && event.type == SDL_EVENT_MOUSE_BUTTON_UP && event.button.button == SDL_BUTTON_LEFT)
             {
+                bPainting = false;
                 float x = event.button.x;
                 float y = event.button.y;
                 bool editHandled = false;
@@ -1507,21 +4826,74 @@ private:
                 StateMgr.HandleInput(event);
             }
         }
+        return quit;
+    }
+
+    // Handles input, then advances the view and simulation by the frame's share of fixed ticks.
+    // IdleNS is time spent in WaitForWork; it counts only for what was not asleep.
+    int Update(Uint64 FrameNS, Uint64 IdleNS = 0)
+    {
+        ProfileScope zone("Game::Update");
+        int quit = PollEvents();
+
+        ViewAccumulator += FrameNS + (bViewSlept ? 0 : IdleNS);
+        while (ViewAccumulator >= TickNS)
+        {
+            StateMgr.UpdateView();
+            ViewAccumulator -= TickNS;
+        }
+        StateMgr.SetViewAlpha(static_cast<float>(ViewAccumulator) / TickNS);
+        if (Prof.bShowOverlay)
+            Redraw.Invalidate(); // The graph scrolls every frame
 
-        StateMgr.Update();
+        SimAccumulator += (FrameNS + (bSimSlept ? 0 : IdleNS)) * SimSpeed;
+        Uint64 simStart = SDL_GetTicksNS();
+        while (SimAccumulator >= TickNS)
+        {
+            StateMgr.Update();
+            SimAccumulator -= TickNS;
+            ++SimTicks;
+            bInputSinceSimTick = false;
+            if (SDL_GetTicksNS() - simStart >= SimBudgetNS)
+            {
+                SimAccumulator %= TickNS;
+                break;
+            }
+        }
 
         Fps->ObjectCount = StateMgr.GetObjNum();
+        Fps->SimSpeed = SimSpeed;
+        Fps->SimTicks = SimTicks;
         Fps->Update();
 
+        {
+            // Here rather than in Render, so textures keep arriving while no frame is drawn.
+            ProfileScope resourceZone("ResourceManager::Update");
+            RM.Update();
+        }
+
         return quit;
     }
 
     void Render()
     {
+        ProfileScope zone("Game::Render");
         RI->PreRender();
 
         StateMgr.Render(RI);
+        RenderPalette();
+
+        Fps->CountFrame();
+        Fps->Render(RI);
+        Prof.RenderOverlay(RI);
+
+        ProfileScope presentZone("PostRender");
+        RI->PostRender();
+    }
 
+    void RenderPalette()
+    {
+        ProfileScope zone("Palette");
         // Render buch-outdoor.bmp at bottom right with scaling
         Texture& tileTex = RM.GetTex(ResourceManager::ResID_Tile);
         float scale = HEX_FLAT_TOP_WIDTH / Tile::SourceBitmapTileSize;
@@ -1568,36 +4940,85 @@ private:
             };
             RI->RenderBox(&selRect, 255, 0, 0, 255);
         }
+    }
 
-        Fps->Render(RI);
+    // Blocks until an event arrives or the next tick that can change something is due. View ticks
+    // matter only while the camera moves, chunks stream in or textures load; simulation ticks only
+    // after input or at the next economy month. With neither, it waits for input alone.
+    // SinceLastFrameNS is time already elapsed that the accumulators do not hold. Returns the time
+    // waited, up to the moment the tick was due; oversleeping counts as ordinary frame time.
+    Uint64 WaitForWork(Uint64 SinceLastFrameNS)
+    {
+        const Uint64 never = ~Uint64(0);
+        bViewSlept = StateMgr.IsViewIdle() && !RM.IsLoading();
+        Uint64 viewDue = never;
+        if (!bViewSlept)
+            viewDue = ViewAccumulator + SinceLastFrameNS < TickNS ? TickNS - ViewAccumulator - SinceLastFrameNS : 0;
+
+        int simTicks = bInputSinceSimTick ? 1 : StateMgr.GetSimTicksUntilWork();
+        bSimSlept = simTicks < 0;
+        Uint64 simDue = never;
+        if (!bSimSlept)
+        {
+            Uint64 simTarget = simTicks * TickNS;
+            Uint64 simNeed = SimAccumulator < simTarget ? (simTarget - SimAccumulator + SimSpeed - 1) / SimSpeed : 0;
+            simDue = simNeed > SinceLastFrameNS ? simNeed - SinceLastFrameNS : 0;
+        }
 
-        RI->PostRender();
+        Uint64 waitNS = std::min(viewDue, simDue);
+        if (waitNS == 0)
+            return 0;
+        Uint64 start = SDL_GetTicksNS();
+        // Rounded up: waking a little late costs a fraction of a tick, waking early costs a spin.
+        Sint32 waitMS = waitNS == never ? -1 : static_cast<Sint32>(std::min<Uint64>((waitNS + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS, SDL_MAX_SINT32));
+        SDL_WaitEventTimeout(nullptr, waitMS);
+        return std::min(SDL_GetTicksNS() - start, waitNS);
     }
 
     void loop()
     {
         int quit = 0;
+        Uint64 previous = SDL_GetTicksNS();
         while (!quit)
         {
-            quit = Update();
-            Render();
-            SDL_Delay(10);
+            Uint64 idleNS = 0;
+            if (bOnDemandRendering && !Redraw.bDirty)
+                idleNS = WaitForWork(SDL_GetTicksNS() - previous);
+
+            Uint64 frameStart = SDL_GetTicksNS();
+            Prof.BeginFrame();
+            // Waiting is not a slow frame, so only the rest is clamped.
+            quit = Update(std::min(frameStart - previous - idleNS, MaxFrameNS), idleNS);
+            previous = frameStart;
+            bool bDraw = Redraw.bDirty || !bOnDemandRendering;
+            if (bDraw)
+            {
+                Redraw.bDirty = false;
+                Render();
+            }
+            Prof.EndFrame(); // Frame cost excludes the frame-cap sleep below
+
+            // Caps the frame rate without tying it to the tick rate; interpolation covers the gap.
+            Uint64 frameNS = SDL_GetTicksNS() - frameStart;
+            if (bDraw && frameNS < MinFrameNS)
+                SDL_DelayNS(MinFrameNS - frameNS);
         }
     }
 
     void terminate()
     {
         StateMgr.Destroy();
+        RM.Destroy();
 
+        if (Fps) {
+            delete Fps;
+            Fps = nullptr;
+        }
         if (RI) {
             RI->Destroy();
             delete RI;
             RI = nullptr;
         }
-        if (Fps) {
-            delete Fps;
-            Fps = nullptr;
-        }
     }
 
 public:
@@ -1607,10 +5028,614 @@ public:
         loop();
         terminate();
     }
+
+    // Loads MapFile, then runs Frames frames of one fixed tick each (Update + Render) while a
+    // synthetic right-drag sweeps the camera back and forth, and writes frame-time percentiles
+    // and throughput as JSON to JsonFile, or stdout when it is empty. Meant for Game(true).
+    int Benchmark(const std::string& MapFile, int Frames, const std::string& JsonFile)
+    {
+        // Game code logs to stdout; send that to stderr so stdout carries only the JSON.
+        std::streambuf* pStdout = std::cout.rdbuf(std::cerr.rdbuf());
+        init();
+        StateMgr.LoadMap(MapFile);
+
+        // Warm-up frames let the lazy textures and the first chunks arrive before measuring.
+        const int warmupFrames = 60;
+        std::vector<Uint64> updateNS, renderNS, frameNS;
+        updateNS.reserve(Frames);
+        renderNS.reserve(Frames);
+        frameNS.reserve(Frames);
+
+        SDL_Event drag = {};
+        drag.type = SDL_EVENT_MOUSE_BUTTON_DOWN;
+        drag.button.button = SDL_BUTTON_RIGHT;
+        drag.button.x = VP.WIDTH * 0.5f;
+        drag.button.y = VP.HEIGHT * 0.5f;
+        SDL_PushEvent(&drag);
+
+        Uint64 benchStart = SDL_GetTicksNS();
+        for (int f = -warmupFrames; f < Frames; ++f)
+        {
+            if (f == 0)
+                benchStart = SDL_GetTicksNS();
+
+            float dir = ((f + warmupFrames) / 300) % 2 == 0 ? 1.0f : -1.0f;
+            drag = {};
+            drag.type = SDL_EVENT_MOUSE_MOTION;
+            drag.motion.x = VP.WIDTH * 0.5f;
+            drag.motion.y = VP.HEIGHT * 0.5f;
+            drag.motion.xrel = -8.0f * dir;
+            drag.motion.yrel = -4.0f * dir;
+            SDL_PushEvent(&drag);
+
+            Uint64 t0 = SDL_GetTicksNS();
+            Prof.BeginFrame();
+            Update(TickNS);
+            Uint64 t1 = SDL_GetTicksNS();
+            Render();
+            Prof.EndFrame();
+            Uint64 t2 = SDL_GetTicksNS();
+            if (f >= 0)
+            {
+                updateNS.push_back(t1 - t0);
+                renderNS.push_back(t2 - t1);
+                frameNS.push_back(t2 - t0);
+            }
+        }
+        double totalMs = (SDL_GetTicksNS() - benchStart) / 1e6;
+
+        const char* rendererName = SDL_GetRendererName(static_cast<SDL_Renderer*>(RI->GetRenderer()));
+        std::ostringstream json;
+        json << "{\n";
+        json << "  \"map\": \"" << JsonEscape(MapFile) << "\",\n";
+        json << "  \"renderer\": \"" << JsonEscape(rendererName ? rendererName : "") << "\",\n";
+        json << "  \"frames\": " << Frames << ",\n";
+        json << "  \"objects\": " << StateMgr.GetObjNum() << ",\n";
+        json << "  \"total_ms\": " << totalMs << ",\n";
+        json << "  \"frames_per_second\": " << (totalMs > 0 ? Frames * 1000.0 / totalMs : 0.0) << ",\n";
+        json << "  \"frame_ms\": " << PercentilesJson(frameNS) << ",\n";
+        json << "  \"update_ms\": " << PercentilesJson(updateNS) << ",\n";
+        json << "  \"render_ms\": " << PercentilesJson(renderNS) << "\n";
+        json << "}\n";
+
+        terminate();
+        std::cout.rdbuf(pStdout);
+
+        if (JsonFile.empty())
+        {
+            std::cout << json.str();
+            return 0;
+        }
+        std::ofstream out(JsonFile);
+        out << json.str();
+        if (!out)
+        {
+            std::cerr << "Failed to write benchmark results to " << JsonFile << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    static std::string JsonEscape(const std::string& text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    static std::string PercentilesJson(std::vector<Uint64> samplesNS)
+    {
+        if (samplesNS.empty())
+            return "{}";
+        std::sort(samplesNS.begin(), samplesNS.end());
+        auto at = [&](double p) { return samplesNS[static_cast<size_t>(p * (samplesNS.size() - 1) + 0.5)] / 1e6; };
+        double sum = 0;
+        for (Uint64 ns : samplesNS)
+            sum += ns / 1e6;
+
+        std::ostringstream out;
+        out << "{ \"mean\": " << sum / samplesNS.size() << ", \"min\": " << at(0.0) << ", \"p50\": " << at(0.50)
+            << ", \"p95\": " << at(0.95) << ", \"p99\": " << at(0.99) << ", \"max\": " << at(1.0) << " }";
+        return out.str();
+    }
+};
+
+// --- Micro-benchmarks ---
+// SDLGame --microbench [out.json] [--baseline old.json]: times engine hot paths one by one, headless.
+// Each case reports the median ns per operation over Batches timed batches. With a baseline (a file
+// written by an earlier run) every case also gets its ratio to the stored value, and the run fails
+// once any case is RegressionRatio times slower. Cases that check their result fail the run when it is wrong.
+class MicroBench
+{
+    struct Result
+    {
+        std::string Name;
+        double NsPerOp = 0;
+        Uint64 Ops = 0;
+        double BaselineNsPerOp = 0; // 0 when the baseline has no such case
+        Uint64 ItemsPerOp = 0;      // Set for throughput cases, reported as items per second
+    };
+
+    static constexpr int Batches = 5;
+    static constexpr int SetupRuns = 9; // Single timed operations are noisier, so take more samples
+    static constexpr Uint64 MinBatchNS = 20 * SDL_NS_PER_MS;
+    static constexpr double RegressionRatio = 1.25;
+
+    std::vector<Result> Results;
+    int Failures = 0; // Cases whose result was checked and found wrong
+    Uint64 Sink = 0; // Keeps results of the timed code alive
+    Uint32 RandState = 0x9E3779B9u;
+
+    Viewport VP;
+    SDLRenderInterface RI{ true };
+
+    Uint32 Random()
+    {
+        RandState ^= RandState << 13;
+        RandState ^= RandState >> 17;
+        RandState ^= RandState << 5;
+        return RandState;
+    }
+
+    // Grows the batch until it lasts MinBatchNS, then records the median of Batches batches.
+    // AfterBatch runs untimed, e.g. to present the draw calls a batch queued up.
+    template <typename Op, typename After>
+    void Run(const std::string& Name, Op&& Operation, After&& AfterBatch)
+    {
+        Uint64 iterations = 1;
+        for (;;)
+        {
+            Uint64 t0 = SDL_GetTicksNS();
+            for (Uint64 k = 0; k < iterations; ++k)
+                Sink += static_cast<Uint64>(Operation());
+            Uint64 elapsed = SDL_GetTicksNS() - t0;
+            AfterBatch();
+            if (elapsed >= MinBatchNS || iterations >= (Uint64(1) << 30))
+                break;
+            iterations = elapsed > 0 ? std::max(iterations * 2, iterations * MinBatchNS / elapsed + 1) : iterations * 16;
+        }
+
+        std::vector<double> samples;
+        for (int b = 0; b < Batches; ++b)
+        {
+            Uint64 t0 = SDL_GetTicksNS();
+            for (Uint64 k = 0; k < iterations; ++k)
+                Sink += static_cast<Uint64>(Operation());
+            samples.push_back(static_cast<double>(SDL_GetTicksNS() - t0) / iterations);
+            AfterBatch();
+        }
+        Record(Name, samples, iterations * Batches);
+    }
+
+    template <typename Op>
+    void Run(const std::string& Name, Op&& Operation)
+    {
+        Run(Name, std::forward<Op>(Operation), [] {});
+    }
+
+    // For operations that consume their input: Setup runs untimed before every timed Operation.
+    template <typename Prepare, typename Op>
+    void RunWithSetup(const std::string& Name, Prepare&& Setup, Op&& Operation)
+    {
+        std::vector<double> samples;
+        for (int b = 0; b < SetupRuns; ++b)
+        {
+            Setup();
+            Uint64 t0 = SDL_GetTicksNS();
+            Sink += static_cast<Uint64>(Operation());
+            samples.push_back(static_cast<double>(SDL_GetTicksNS() - t0));
+        }
+        Record(Name, samples, SetupRuns);
+    }
+
+    void Record(const std::string& Name, std::vector<double>& Samples, Uint64 Ops)
+    {
+        std::sort(Samples.begin(), Samples.end());
+        Results.push_back({ Name, Samples[Samples.size() / 2], Ops });
+        std::cerr << Name << ": " << Results.back().NsPerOp << " ns/op" << std::endl;
+    }
+
+    // Square map of random plain tiles with a castle every 1000 cells, written as CSV.
+    bool WriteTestMap(const std::string& filename, int Size, std::vector<Uint16>& OutData)
+    {
+        OutData.resize(static_cast<size_t>(Size) * Size);
+        for (size_t k = 0; k < OutData.size(); ++k)
+            OutData[k] = k % 1000 == 999 ? TileStore::CastleBitmapIdx : static_cast<Uint16>(Random() % 64);
+        return MapIO::WriteCSV(filename, OutData, Size, Size);
+    }
+
+    bool WriteTestMap(const std::string& filename, int Size)
+    {
+        std::vector<Uint16> data;
+        return WriteTestMap(filename, Size, data);
+    }
+
+    void BenchHexTest()
+    {
+        SDL_FRect hex = TileStore::GetDestRect(3, 3);
+        std::vector<SDL_FPoint> points(1024);
+        for (SDL_FPoint& p : points)
+            p = { hex.x + (Random() % 1000) * hex.w / 1000.0f, hex.y + (Random() % 1000) * hex.h / 1000.0f };
+        size_t k = 0;
+        Run("Tile::IsInHex", [&] { const SDL_FPoint& p = points[k++ & 1023]; return Tile::IsInHex(hex, p.x, p.y, HEX_SIDE_LENGTH); });
+    }
+
+    void BenchMapSize(int Size)
+    {
+        const std::string dims = std::to_string(Size) + "x" + std::to_string(Size);
+        const std::string csvFile = "microbench_" + dims + ".txt";
+        const std::string binFile = "microbench_" + dims + ".hxmap";
+        std::vector<Uint16> data;
+        if (!WriteTestMap(csvFile, Size, data))
+            return;
+
+        Level level;
+        level.Init(VP, &RI);
+        Run("Level::LoadMap/csv/" + dims, [&] { level.LoadMap(csvFile); return level.GetObjNum(); });
+
+        std::vector<SDL_FPoint> points(4096);
+        for (SDL_FPoint& p : points)
+            p = { static_cast<float>(Random() % VP.WIDTH), static_cast<float>(Random() % VP.HEIGHT) };
+        size_t k = 0;
+        Run("Level::GetTileAtPosition/" + dims, [&] { const SDL_FPoint& p = points[k++ & 4095]; return level.GetTileAtPosition(p.x, p.y); });
+
+        level.Destroy();
+
+        // Saving is serialization and write only; SaveMap also reopens the streamer, which is a
+        // full parse for CSV and a header check for binary, so reopening is timed on its own.
+        Run("MapIO::Write/hxmap/" + dims, [&] { return MapIO::Write(binFile, data, Size, Size); });
+        Run("MapIO::Write/csv/" + dims, [&] { return MapIO::Write(csvFile, data, Size, Size); });
+
+        MapStreamer streamer;
+        int w = 0, h = 0;
+        Run("MapStreamer::Open/hxmap/" + dims, [&] { streamer.Open(binFile, w, h); return w; });
+        Run("MapStreamer::Open/csv/" + dims, [&] { streamer.Open(csvFile, w, h); return w; });
+        streamer.Close();
+        std::remove(csvFile.c_str());
+        std::remove(binFile.c_str());
+    }
+
+    // Small maps whose line endings and blanks the parser must read the same way.
+    void CheckParseCSV()
+    {
+        const struct { const char* Text; int W; int H; std::vector<Uint16> Values; } cases[] = {
+            { "1,2\r3,4\r", 2, 2, { 1, 2, 3, 4 } },
+            { "1,2\r3,4\n5,6\r\n\r\n7,8", 2, 4, { 1, 2, 3, 4, 5, 6, 7, 8 } },
+            { "1,2\n \n3,4\n", 2, 2, { 1, 2, 3, 4 } },
+            { " \t\n1,2\n3,4", 2, 2, { 1, 2, 3, 4 } },
+            { "1,2, \n3,4,\t\n", 2, 2, { 1, 2, 3, 4 } },
+            { "1, 2 ,3\n 4,5 , 6 \n", 3, 2, { 1, 2, 3, 4, 5, 6 } },
+        };
+        for (const auto& c : cases)
+        {
+            std::vector<Uint16> parsed;
+            int w = 0, h = 0;
+            if (!MapIO::ParseCSV(c.Text, std::strlen(c.Text), parsed, w, h) || w != c.W || h != c.H || parsed != c.Values)
+            {
+                std::string shown;
+                for (const char* q = c.Text; *q; ++q)
+                    shown += *q == '\r' ? "\\r" : *q == '\n' ? "\\n" : *q == '\t' ? "\\t" : std::string(1, *q);
+                std::cerr << "MapIO::ParseCSV: misread \"" << shown << "\" as " << w << "x" << h << std::endl;
+                ++Failures;
+            }
+        }
+    }
+
+    // Every line ending the parser accepts: LF, CRLF, bare CR and a mix of them. Each text is
+    // checked once against the data it was written from before it is timed.
+    void BenchParseCSV()
+    {
+        const int size = 512;
+        std::vector<Uint16> data(static_cast<size_t>(size) * size);
+        for (Uint16& value : data)
+            value = static_cast<Uint16>(Random() % 300);
+
+        const char* mixed[] = { "\n", "\r\n", "\r", "\r\n\n" };
+        const struct { const char* Name; const char* const* Eols; int EolCount; } cases[] = {
+            { "lf", mixed, 1 }, { "crlf", mixed + 1, 1 }, { "cr", mixed + 2, 1 }, { "mixed", mixed, 4 },
+        };
+        for (const auto& c : cases)
+        {
+            std::string text;
+            for (int j = 0; j < size; ++j)
+            {
+                for (int i = 0; i < size; ++i)
+                {
+                    text += std::to_string(data[static_cast<size_t>(j) * size + i]);
+                    if (i + 1 < size)
+                        text += ',';
+                }
+                text += c.Eols[j % c.EolCount];
+            }
+
+            const std::string name = std::string("MapIO::ParseCSV/") + c.Name;
+            std::vector<Uint16> parsed;
+            int w = 0, h = 0;
+            if (!MapIO::ParseCSV(text.data(), text.size(), parsed, w, h) || w != size || h != size || parsed != data)
+            {
+                std::cerr << name << ": parsed map does not match the written one" << std::endl;
+                ++Failures;
+                continue;
+            }
+            Run(name, [&] { MapIO::ParseCSV(text.data(), text.size(), parsed, w, h); return w; });
+        }
+    }
+
+    void BenchText(int Length)
+    {
+        std::string text, other;
+        for (int k = 0; k < Length; ++k)
+        {
+            text += static_cast<char>('a' + k % 26);
+            other += static_cast<char>('A' + k % 26);
+        }
+        const std::string len = std::to_string(Length);
+        // Without a font every call only logs an error, which is not worth a number.
+        if (!RI.HasFont())
+        {
+            std::cerr << "Skipping text cases of length " << len << ": no font loaded" << std::endl;
+            return;
+        }
+
+        Run("SDLRenderInterface::RenderText/" + len, [&] { RI.RenderText(text, 10, 10, 0); return 0; }, [&] { RI.PostRender(); });
+
+        Run("SDLRenderInterface::CreateTextTexture/" + len, [&]
+            {
+                SDL_FRect rect;
+                SDL_Texture* pTex = RI.CreateTextTexture(text, &rect, 0, 0);
+                SDL_DestroyTexture(pTex);
+                return pTex != nullptr;
+            });
+
+        // Labels rasterize when drawn; alternating strings make every draw rasterize again.
+        int label = RI.CreateLabel();
+        bool bOther = false;
+        Run("SDLRenderInterface::SetLabelText+RenderLabel/" + len, [&]
+            {
+                bOther = !bOther;
+                RI.SetLabelText(label, bOther ? other : text);
+                RI.RenderLabel(label, 10, 10, 0);
+                return 0;
+            }, [&] { RI.PostRender(); });
+        RI.DestroyLabel(label);
+    }
+
+    void BenchObjects(int Count)
+    {
+        const std::string count = std::to_string(Count);
+        const std::string mapFile = "microbench_objects.txt";
+        const int size = 512;
+        if (!WriteTestMap(mapFile, size))
+            return;
+        Level level;
+        level.Init(VP, &RI);
+        level.LoadMap(mapFile);
+
+        auto populate = [&](bool bHideHalf)
+        {
+            level.DestroyAllObjects();
+            for (int k = 0; k < Count; ++k)
+            {
+                Entity e = level.CreateUnit(Unit_Spearman, Faction_Wee, static_cast<int>(Random() % (size * size)));
+                if (bHideHalf && (k & 1))
+                    level.RemoveEntity(e);
+            }
+        };
+        RunWithSetup("Level::Update/scan/" + count, [&] { populate(false); }, [&] { level.Update(); return level.GetObjNum(); });
+        RunWithSetup("Level::Update/delete/" + count, [&] { populate(true); }, [&] { level.Update(); return level.GetObjNum(); });
+
+        // Castles among the units; lookups land on random cells, so most miss like real clicks do.
+        level.DestroyAllObjects();
+        for (int k = 0; k < Count; ++k)
+        {
+            int cell = static_cast<int>(Random() % (size * size));
+            if (k % 10 == 0)
+                level.createCastle(cell, Faction_Chok);
+            else
+                level.createSpearman(cell, Faction_Wee);
+        }
+        CastleInfoWnd wnd("microbench", { 0, 0, 230, 300 }, &RI);
+        Run("Level::SetCastleInfoWnd/" + count, [&] { level.SelectedIndex = static_cast<int>(Random() % (size * size)); return level.SetCastleInfoWnd(&wnd); });
+
+        level.Destroy();
+        std::remove(mapFile.c_str());
+    }
+
+    // Castle-ticks per second of the economy on its own, without any entities around it.
+    // Upkeep against plain division, over garrisons well past the default 14000 and up to INT_MAX.
+    void CheckEconomyUpkeep()
+    {
+        CastleEconomy economy;
+        std::vector<int> garrisons;
+        for (int soldiers = 0; soldiers <= 400000; ++soldiers)
+            garrisons.push_back(soldiers);
+        for (int soldiers : { 1000000, 99999999, 2147483600, 2147483647 })
+            garrisons.push_back(soldiers);
+
+        const int food = 1000000000;
+        for (size_t k = 0; k < garrisons.size(); ++k)
+        {
+            CastleStats stats;
+            stats.Food = food;
+            stats.Soldier = garrisons[k];
+            economy.Add(static_cast<Uint32>(k), stats);
+        }
+        economy.Tick(); // First month of the season, so no harvest
+        for (size_t k = 0; k < garrisons.size(); ++k)
+        {
+            int expected = food - garrisons[k] / CastleEconomy::SoldiersPerFood;
+            if (economy.Get(static_cast<Uint32>(k)).Food != expected)
+            {
+                std::cerr << "CastleEconomy::Tick: " << garrisons[k] << " soldiers left " << economy.Get(static_cast<Uint32>(k)).Food
+                    << " food, expected " << expected << std::endl;
+                ++Failures;
+                return;
+            }
+        }
+    }
+
+    void BenchEconomy(int Count)
+    {
+        CastleEconomy economy;
+        for (int k = 0; k < Count; ++k)
+        {
+            CastleStats stats;
+            stats.Gold = static_cast<int>(Random() % 10000);
+            stats.Food = 1000000 + static_cast<int>(Random() % 10000);
+            stats.Soldier = static_cast<int>(Random() % 20000);
+            stats.Spears = static_cast<int>(Random() % 5000);
+            economy.Add(static_cast<Uint32>(k), stats);
+        }
+        Run("CastleEconomy::Tick/" + std::to_string(Count), [&] { economy.Tick(); return economy.Gold[0]; });
+        Result& r = Results.back();
+        r.ItemsPerOp = static_cast<Uint64>(Count);
+        std::cerr << "  " << static_cast<Uint64>(Count * 1e9 / r.NsPerOp) << " castle-ticks/s" << std::endl;
+    }
+
+    bool LoadBaseline(const std::string& filename)
+    {
+        std::ifstream in(filename);
+        if (!in)
+        {
+            std::cerr << "Failed to open baseline " << filename << std::endl;
+            return false;
+        }
+        // Written by WriteJson: one case per line, name first.
+        std::string line;
+        while (std::getline(in, line))
+        {
+            size_t nameAt = line.find("\"name\": \"");
+            size_t nsAt = line.find("\"ns_per_op\": ");
+            if (nameAt == std::string::npos || nsAt == std::string::npos)
+                continue;
+            nameAt += 9;
+            std::string name = line.substr(nameAt, line.find('"', nameAt) - nameAt);
+            double ns = std::atof(line.c_str() + nsAt + 13);
+            for (Result& r : Results)
+                if (r.Name == name)
+                    r.BaselineNsPerOp = ns;
+        }
+        return true;
+    }
+
+    void WriteJson(std::ostream& out, bool bBaseline) const
+    {
+        out << "{\n  \"version\": 1,\n  \"benchmarks\": [\n";
+        for (size_t k = 0; k < Results.size(); ++k)
+        {
+            const Result& r = Results[k];
+            out << "    { \"name\": \"" << r.Name << "\", \"ns_per_op\": " << r.NsPerOp << ", \"ops\": " << r.Ops;
+            if (r.ItemsPerOp > 0)
+                out << ", \"items_per_second\": " << static_cast<Uint64>(r.ItemsPerOp * 1e9 / r.NsPerOp);
+            if (bBaseline && r.BaselineNsPerOp > 0)
+            {
+                double ratio = r.NsPerOp / r.BaselineNsPerOp;
+                out << ", \"baseline_ns_per_op\": " << r.BaselineNsPerOp << ", \"ratio\": " << ratio
+                    << ", \"regressed\": " << (ratio >= RegressionRatio ? "true" : "false");
+            }
+            out << " }" << (k + 1 < Results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+    }
+
+public:
+    int Main(const std::string& JsonFile, const std::string& BaselineFile)
+    {
+        // Game code logs to stdout; send that to stderr so stdout carries only the JSON.
+        std::streambuf* pStdout = std::cout.rdbuf(std::cerr.rdbuf());
+        if (!RI.CreateRenderer(&VP))
+            return 1;
+        RM.LoadResources(&RI);
+
+        BenchHexTest();
+        for (int size : { 64, 512, 2048 })
+            BenchMapSize(size);
+        CheckParseCSV();
+        BenchParseCSV();
+        for (int length : { 8, 32, 128 })
+            BenchText(length);
+        for (int count : { 1000, 10000, 100000 })
+            BenchObjects(count);
+        CheckEconomyUpkeep();
+        for (int count : { 10, 10000, 1000000 })
+            BenchEconomy(count);
+
+        RM.Destroy();
+        RI.Destroy();
+        std::cout.rdbuf(pStdout);
+
+        bool bBaseline = !BaselineFile.empty();
+        if (bBaseline && !LoadBaseline(BaselineFile))
+            return 1;
+
+        int regressions = 0;
+        if (bBaseline)
+        {
+            for (const Result& r : Results)
+            {
+                if (r.BaselineNsPerOp <= 0)
+                    continue;
+                double ratio = r.NsPerOp / r.BaselineNsPerOp;
+                if (ratio >= RegressionRatio)
+                    ++regressions;
+                std::cerr << (ratio >= RegressionRatio ? "REGRESSED " : "          ") << r.Name << ": "
+                    << r.BaselineNsPerOp << " -> " << r.NsPerOp << " ns/op (x" << ratio << ")" << std::endl;
+            }
+        }
+
+        if (JsonFile.empty())
+        {
+            WriteJson(std::cout, bBaseline);
+        }
+        else
+        {
+            std::ofstream out(JsonFile);
+            WriteJson(out, bBaseline);
+            if (!out)
+            {
+                std::cerr << "Failed to write benchmark results to " << JsonFile << std::endl;
+                return 1;
+            }
+        }
+        return regressions > 0 || Failures > 0 ? 1 : 0;
+    }
 };
 
 int main(int argc, char** argv)
 {
+    // SDLGame --convert-map <in> <out>: CSV <-> binary, format chosen by the .hxmap extension.
+    if (argc == 4 && std::strcmp(argv[1], "--convert-map") == 0)
+        return MapIO::Convert(argv[2], argv[3]);
+
+    // SDLGame --benchmark <map> [frames] [out.json]: headless frame-time benchmark, see Game::Benchmark.
+    if (argc >= 3 && std::strcmp(argv[1], "--benchmark") == 0)
+    {
+        int frames = argc >= 4 ? std::atoi(argv[3]) : 600;
+        Game bench(true);
+        return bench.Benchmark(argv[2], std::max(frames, 1), argc >= 5 ? argv[4] : "");
+    }
+
+    // SDLGame --microbench [out.json] [--baseline old.json]: per-function timings, see MicroBench.
+    if (argc >= 2 && std::strcmp(argv[1], "--microbench") == 0)
+    {
+        std::string jsonFile, baselineFile;
+        for (int k = 2; k < argc; ++k)
+        {
+            if (std::strcmp(argv[k], "--baseline") == 0 && k + 1 < argc)
+                baselineFile = argv[++k];
+            else
+                jsonFile = argv[k];
+        }
+        MicroBench bench;
+        return bench.Main(jsonFile, baselineFile);
+    }
+
     Game game;
     game.Start();
     return 0;